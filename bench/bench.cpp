@@ -0,0 +1,441 @@
+//
+//  bench.cpp
+//  cppl
+//
+//  Compiler throughput benchmarks, run over a generated program. Results
+//  are written to stdout as one JSON object per benchmark per line.
+//
+
+#include "generate.h"
+#include "../src/cppl.h"
+#include "../src/driver.h"
+#include "../src/lexer.h"
+#include "../src/parse.h"
+#include "../src/prgm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Hardware counters for the benchmarked code, read with perf_event_open
+struct PerfCounters {
+    static const int COUNT = 4;
+    int fds[COUNT] = { -1, -1, -1, -1 };
+    uint64_t values[COUNT] = { 0, 0, 0, 0 };
+
+    bool open() {
+        static const uint64_t configs[COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for (int i=0; i<COUNT; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds[i] < 0) return false;
+        }
+        return true;
+    }
+
+    void start() {
+        for (int i=0; i<COUNT; i++) {
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    void stop() {
+        for (int i=0; i<COUNT; i++) {
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value = 0;
+            if (read(fds[i], &value, sizeof(value)) == sizeof(value)) values[i] += value;
+        }
+    }
+};
+
+struct BenchConfig {
+    GenParams gen;
+    unsigned iterations = 5;
+    unsigned optLevel = 0;
+    bool perf = false;
+    std::string only;
+    // The embed and spawn benchmarks
+    unsigned buffers = 10000;
+    std::string cpplPath = "./cppl";
+};
+
+// What one iteration of a benchmark processed, for computing rates
+struct Work {
+    uint64_t bytes = 0;
+    uint64_t tokens = 0;
+    uint64_t functions = 0;
+    uint64_t ops = 0;
+};
+
+// Run body config.iterations times, timing only what it passes to timed,
+// and report the best and mean times
+static void bench(const BenchConfig &config, const char *name,
+                  std::function<Work(std::function<void(std::function<void()>)>)> body) {
+    if (! config.only.empty() && config.only != name) return;
+
+    PerfCounters counters;
+    if (config.perf && ! counters.open()) {
+        std::cerr << "cppl_bench: perf_event_open failed, not reporting counters\n";
+    }
+
+    std::vector<double> times;
+    Work work;
+    for (unsigned i=0; i<config.iterations; i++) {
+        double seconds = 0;
+        work = body([&](std::function<void()> timed) {
+            counters.start();
+            auto start = std::chrono::steady_clock::now();
+            timed();
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            counters.stop();
+        });
+        times.push_back(seconds);
+    }
+
+    double best = *std::min_element(times.begin(), times.end());
+    double mean = 0;
+    for (auto t : times) mean += t;
+    mean /= times.size();
+
+    std::cout << "{\"benchmark\":\"" << name << "\""
+              << ",\"iterations\":" << config.iterations
+              << ",\"best_s\":" << best
+              << ",\"mean_s\":" << mean;
+    if (work.bytes) {
+        std::cout << ",\"bytes\":" << work.bytes << ",\"mb_per_s\":" << work.bytes / best / 1e6;
+    }
+    if (work.tokens) {
+        std::cout << ",\"tokens\":" << work.tokens << ",\"tokens_per_s\":" << work.tokens / best;
+    }
+    if (work.functions) {
+        std::cout << ",\"functions\":" << work.functions << ",\"functions_per_s\":" << work.functions / best;
+    }
+    if (work.ops) {
+        std::cout << ",\"ops\":" << work.ops << ",\"ops_per_s\":" << work.ops / best;
+    }
+    if (counters.fds[0] >= 0) {
+        // Counters are summed over every iteration; report them per iteration
+        static const char *names[PerfCounters::COUNT] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+        for (int i=0; i<PerfCounters::COUNT; i++) {
+            std::cout << ",\"" << names[i] << "\":" << counters.values[i] / config.iterations;
+        }
+    }
+    std::cout << "}\n";
+}
+
+static void usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "Benchmarks the compiler over a generated program\n"
+              << "\n"
+              << "Program options:\n"
+              << "  --functions=<n>   Functions in the program (default 1000)\n"
+              << "  --statements=<n>  Statements per function (default 10)\n"
+              << "  --depth=<n>       Maximum expression depth (default 3)\n"
+              << "  --vocabulary=<n>  Distinct local names (default 16)\n"
+              << "  --literals=<n>    Percentage of leaves which are literals (default 30)\n"
+              << "  --seed=<n>        Seed of the generator (default 1)\n"
+              << "  --generate        Print the program rather than benchmarking it\n"
+              << "\n"
+              << "Benchmark options:\n"
+              << "  --iterations=<n>  Times to run each benchmark (default 5)\n"
+              << "  -O<n>             Optimization level for the driver benchmark (default 0)\n"
+              << "  --only=<name>     Only run one of lex, intern, parse, finalize, driver,\n"
+              << "                    incremental, embed or spawn\n"
+              << "  --buffers=<n>     Small programs compiled by embed and spawn (default 10000)\n"
+              << "  --cppl=<path>     The cppl executable spawn runs (default ./cppl)\n"
+              << "  --perf            Report hardware counters from perf_event_open\n";
+}
+
+int main(int argc, const char *argv[]) {
+    BenchConfig config;
+    bool generateOnly = false;
+
+    for (int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&](const char *prefix) -> const char * {
+            size_t len = strlen(prefix);
+            return arg.compare(0, len, prefix) == 0 ? argv[i] + len : NULL;
+        };
+
+        if (auto v = value("--functions=")) config.gen.functions = atoi(v);
+        else if (auto v = value("--statements=")) config.gen.statements = atoi(v);
+        else if (auto v = value("--depth=")) config.gen.depth = atoi(v);
+        else if (auto v = value("--vocabulary=")) config.gen.vocabulary = atoi(v);
+        else if (auto v = value("--literals=")) config.gen.literalPercent = atoi(v);
+        else if (auto v = value("--seed=")) config.gen.seed = strtoull(v, NULL, 10);
+        else if (auto v = value("--iterations=")) config.iterations = std::max(1, atoi(v));
+        else if (auto v = value("--only=")) config.only = v;
+        else if (auto v = value("--buffers=")) config.buffers = std::max(1, atoi(v));
+        else if (auto v = value("--cppl=")) config.cpplPath = v;
+        else if (auto v = value("-O")) config.optLevel = atoi(v);
+        else if (arg == "--perf") config.perf = true;
+        else if (arg == "--generate") generateOnly = true;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    auto source = generateProgram(config.gen);
+    if (generateOnly) {
+        std::cout << source;
+        return 0;
+    }
+
+    // Every generated function, plus main
+    uint64_t functions = config.gen.functions + 1;
+
+    bench(config, "lex", [&](std::function<void(std::function<void()>)> timed) {
+        Work work;
+        work.bytes = source.size();
+        timed([&]() {
+            std::istringstream in(source);
+            Lexer lex(&in);
+            while (! lex.eof()) {
+                lex.eat();
+                work.tokens++;
+            }
+        });
+        return work;
+    });
+
+    bench(config, "intern", [&](std::function<void(std::function<void()>)> timed) {
+        // The identifiers of a program like the generated one: a few
+        // locals used over and over, and one name per function
+        std::vector<std::string> names;
+        for (unsigned i=0; i<config.gen.vocabulary; i++) names.push_back("v" + std::to_string(i));
+        for (unsigned i=0; i<config.gen.functions; i++) names.push_back("f" + std::to_string(i));
+
+        Work work;
+        timed([&]() {
+            for (unsigned round=0; round<16; round++) {
+                for (auto &name : names) {
+                    intern(name);
+                    work.ops++;
+                }
+            }
+        });
+        return work;
+    });
+
+    bench(config, "parse", [&](std::function<void(std::function<void()>)> timed) {
+        Work work;
+        work.bytes = source.size();
+        work.functions = functions;
+        std::vector<std::unique_ptr<Item>> items;
+        timed([&]() {
+            std::istringstream in(source);
+            Lexer lex(&in);
+            items = parse(&lex);
+        });
+        return work;
+    });
+
+    bench(config, "finalize", [&](std::function<void(std::function<void()>)> timed) {
+        Work work;
+        work.functions = functions;
+
+        std::istringstream in(source);
+        Lexer lex(&in);
+        auto items = parse(&lex);
+
+        llvm::LLVMContext context;
+        timed([&]() {
+            Program prgm(context);
+            prgm.addItems(items);
+            prgm.finalize();
+            delete prgm.module;
+        });
+        return work;
+    });
+
+    bench(config, "driver", [&](std::function<void(std::function<void()>)> timed) {
+        Work work;
+        work.bytes = source.size();
+        work.functions = functions;
+
+        char input[] = "/tmp/cppl_bench_XXXXXX.cppl";
+        int fd = mkstemps(input, 5);
+        close(fd);
+        std::ofstream(input) << source;
+
+        Options opts;
+        opts.optLevel = config.optLevel;
+        opts.inputs = { input };
+        opts.output = std::string(input) + ".o";
+        // Measure the compiler, not the object cache
+        opts.cacheDir.clear();
+
+        CompilerContext cc;
+        timed([&]() {
+            if (runJob(cc, opts, std::cerr) != 0) {
+                std::cerr << "cppl_bench: compile failed\n";
+                exit(1);
+            }
+        });
+
+        unlink(input);
+        unlink(opts.output.c_str());
+        return work;
+    });
+
+    // Rebuild latency with --incremental after one function is edited. Run
+    // with --functions=10000 for the size of file the database is meant for.
+    char incrementalDir[] = "/tmp/cppl_bench_XXXXXX";
+    bool haveIncrementalDir = false;
+    unsigned edits = 0;
+    bench(config, "incremental", [&](std::function<void(std::function<void()>)> timed) {
+        Work work;
+        work.functions = 1;
+
+        Options opts;
+        opts.optLevel = config.optLevel;
+        opts.cacheDir.clear();
+
+        if (! haveIncrementalDir) {
+            if (mkdtemp(incrementalDir) == NULL) {
+                std::cerr << "cppl_bench: could not create a temporary directory\n";
+                exit(1);
+            }
+            haveIncrementalDir = true;
+        }
+        auto dir = std::string(incrementalDir);
+        opts.incrementalDir = dir + "/db";
+        opts.inputs = { dir + "/input.cppl" };
+        opts.output = dir + "/input.o";
+
+        auto compile = [&](const std::string &program) {
+            std::ofstream(opts.inputs[0]) << program;
+            CompilerContext cc;
+            if (runJob(cc, opts, std::cerr) != 0) {
+                std::cerr << "cppl_bench: compile failed\n";
+                exit(1);
+            }
+        };
+
+        // Fill the database the first time around
+        if (edits == 0) compile(source);
+
+        // Change the return value of a function in the middle of the file
+        auto edited = source;
+        auto fn = edited.find("fn f" + std::to_string(config.gen.functions / 2) + "(");
+        auto ret = edited.find("    return ", fn);
+        edited.insert(ret + 11, std::to_string(++edits) + " + ");
+
+        timed([&]() {
+            compile(edited);
+        });
+        return work;
+    });
+    if (haveIncrementalDir) {
+        system(("rm -rf " + std::string(incrementalDir)).c_str());
+    }
+
+    // Many small compiles, made in process through libcppl by embed, and by
+    // spawning the cppl executable for each by spawn
+    std::vector<std::string> smallSources;
+    auto small = [&]() -> const std::vector<std::string> & {
+        if (smallSources.empty()) {
+            GenParams params = config.gen;
+            params.functions = 4;
+            for (unsigned i=0; i<config.buffers; i++) {
+                params.seed = config.gen.seed + i;
+                smallSources.push_back(generateProgram(params));
+            }
+        }
+        return smallSources;
+    };
+
+    bench(config, "embed", [&](std::function<void(std::function<void()>)> timed) {
+        auto &sources = small();
+        Work work;
+        work.ops = sources.size();
+        for (auto &source : sources) work.bytes += source.size();
+
+        CpplOptions options;
+        options.optLevel = config.optLevel;
+        CpplCompiler compiler;
+        std::string object;
+        timed([&]() {
+            for (auto &source : sources) {
+                if (! compiler.compile(source, options, object)) {
+                    std::cerr << "cppl_bench: compile failed\n";
+                    exit(1);
+                }
+            }
+        });
+        return work;
+    });
+
+    bench(config, "spawn", [&](std::function<void(std::function<void()>)> timed) {
+        auto &sources = small();
+        Work work;
+        work.ops = sources.size();
+        for (auto &source : sources) work.bytes += source.size();
+
+        char dir[] = "/tmp/cppl_bench_XXXXXX";
+        if (mkdtemp(dir) == NULL) {
+            std::cerr << "cppl_bench: could not create a temporary directory\n";
+            exit(1);
+        }
+        for (size_t i=0; i<sources.size(); i++) {
+            std::ofstream(std::string(dir) + "/" + std::to_string(i) + ".cppl") << sources[i];
+        }
+        // Measure the compiler, not the object cache
+        unsetenv("CPPL_CACHE_DIR");
+
+        auto level = "-O" + std::to_string(config.optLevel);
+        timed([&]() {
+            for (size_t i=0; i<sources.size(); i++) {
+                auto input = std::string(dir) + "/" + std::to_string(i) + ".cppl";
+                auto output = std::string(dir) + "/" + std::to_string(i) + ".o";
+                const char *argv[] = { config.cpplPath.c_str(), level.c_str(), input.c_str(), output.c_str(), NULL };
+
+                pid_t pid;
+                int status;
+                if (posix_spawn(&pid, argv[0], NULL, NULL, (char **) argv, environ) != 0 ||
+                    waitpid(pid, &status, 0) != pid || ! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    std::cerr << "cppl_bench: " << config.cpplPath << " " << input << " failed\n";
+                    exit(1);
+                }
+            }
+        });
+
+        system(("rm -rf " + std::string(dir)).c_str());
+        return work;
+    });
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "generate.h"
+
+#include <sstream>
+#include <vector>
+
+// splitmix64, so that programs don't depend on the standard library's
+// random number engines
+struct Rng {
+    uint64_t state;
+
+    explicit Rng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    unsigned below(unsigned n) {
+        return next() % n;
+    }
+
+    bool percent(unsigned p) {
+        return below(100) < p;
+    }
+};
+
+struct Generator {
+    const GenParams &params;
+    Rng rng;
+    std::ostringstream os;
+
+    unsigned fnIdx = 0;
+    std::vector<std::string> locals;
+    unsigned declared = 0;
+
+    Generator(const GenParams &params) : params(params), rng(params.seed) {}
+
+    void leaf() {
+        if (locals.empty() || rng.percent(params.literalPercent)) {
+            os << rng.below(1000);
+        } else {
+            os << locals[rng.below(locals.size())];
+        }
+    }
+
+    void expr(unsigned depth) {
+        if (depth == 0) {
+            leaf();
+            return;
+        }
+
+        switch (rng.below(10)) {
+        case 0: case 1: case 2: case 3: {
+            static const char *ops[] = { "+", "*" };
+            os << "(";
+            expr(depth - 1);
+            os << " " << ops[rng.below(2)] << " ";
+            expr(depth - 1);
+            os << ")";
+        } break;
+        case 4: {
+            // Divide by a non-zero literal, so that the program can be run
+            os << "(";
+            expr(depth - 1);
+            os << (rng.below(2) ? " / " : " % ") << 1 + rng.below(100) << ")";
+        } break;
+        case 5: case 6: {
+            if (fnIdx == 0) {
+                leaf();
+                break;
+            }
+            // Only call earlier functions, so there is no recursion
+            os << "f" << rng.below(fnIdx) << "(";
+            expr(depth - 1);
+            os << ", ";
+            expr(depth - 1);
+            os << ")";
+        } break;
+        case 7: {
+            os << "(if (" << (rng.below(2) ? "true" : "false") << ") { ";
+            expr(depth - 1);
+            os << " } else { ";
+            expr(depth - 1);
+            os << " })";
+        } break;
+        default:
+            leaf();
+        }
+    }
+
+    void stmt() {
+        // Every declaration in a function shares its scope, so names can't
+        // be reused within a function
+        if (declared < params.vocabulary && rng.percent(40)) {
+            std::string name = "v" + std::to_string(declared++);
+            os << "    let " << name << ": i32 = ";
+            expr(params.depth);
+            os << ";\n";
+            locals.push_back(name);
+            return;
+        }
+
+        if (rng.percent(30)) {
+            os << "    if (" << (rng.below(2) ? "true" : "false") << ") {\n        putchar(";
+            expr(params.depth);
+            os << ");\n    };\n";
+        } else {
+            os << "    putchar(";
+            expr(params.depth);
+            os << ");\n";
+        }
+    }
+
+    void function() {
+        locals = { "a", "b" };
+        declared = 0;
+        os << "fn f" << fnIdx << "(a: i32, b: i32): i32 {\n";
+        for (unsigned i=0; i<params.statements; i++) {
+            stmt();
+        }
+        os << "    return ";
+        expr(params.depth);
+        os << ";\n}\n\n";
+        fnIdx++;
+    }
+
+    std::string program() {
+        os << "FFI fn putchar(chr: i32): i32;\n\n";
+        for (unsigned i=0; i<params.functions; i++) {
+            function();
+        }
+
+        os << "fn main(): i32 {\n";
+        if (params.functions > 0) {
+            os << "    putchar(f" << params.functions - 1 << "(1, 2) % 26 + 65);\n";
+        }
+        os << "    return 0;\n}\n";
+        return os.str();
+    }
+};
+
+std::string generateProgram(const GenParams &params) {
+    Generator gen(params);
+    return gen.program();
+}
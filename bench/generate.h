@@ -0,0 +1,32 @@
+//
+//  generate.h
+//  cppl
+//
+//  A deterministic generator of synthetic cppl programs, for benchmarking
+//  the compiler on inputs of any size.
+//
+
+#ifndef __cppl__generate__
+#define __cppl__generate__
+
+#include <cstdint>
+#include <string>
+
+struct GenParams {
+    unsigned functions = 1000;
+    // Statements in the body of each function
+    unsigned statements = 10;
+    // Maximum nesting depth of expressions
+    unsigned depth = 3;
+    // Distinct local variable names. Each function declares at most this
+    // many locals, and the names are shared by every function.
+    unsigned vocabulary = 16;
+    // Percentage of expression leaves which are literals rather than variables
+    unsigned literalPercent = 30;
+    uint64_t seed = 1;
+};
+
+// The same parameters always produce the same program
+std::string generateProgram(const GenParams &params);
+
+#endif /* defined(__cppl__generate__) */
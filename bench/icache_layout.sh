@@ -0,0 +1,79 @@
+#!/bin/sh
+# Measure how laying out cold code away from hot code changes instruction
+# cache misses. The generated program calls a chain of small hot functions,
+# each of which is followed in the source by a large error path which is
+# never taken. It is built three ways:
+#
+#   plain    the error reporting FFI function isn't declared cold
+#   cold     it is, so the error paths are inferred cold and put in
+#            .text.unlikely
+#   ordered  not cold, but the functions entered during a profiling run
+#            are laid out first with --symbol-ordering-file
+#
+# and each is run under perf stat.
+#
+# Usage: icache_layout.sh [path to cppl] [functions]
+
+cppl=${1:-../cppl}
+functions=${2:-2000}
+cc=${CC:-clang}
+
+here=$(cd "$(dirname "$0")" && pwd)
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+# Write the program, with $1 between FFI and fn in the declaration of cppl_fail
+generate() {
+    awk -v n="$functions" -v cold="$1" 'BEGIN {
+        print "FFI const fn cppl_eq(a: i32, b: i32): boolean;"
+        print "FFI const fn cppl_lt(a: i32, b: i32): boolean;"
+        print "FFI fn cppl_print(x: i32): i32;"
+        print "FFI " cold " fn cppl_fail(code: i32): i32;"
+        for (k = 0; k < n; k++) {
+            next_call = k + 1 < n ? "hot_" (k + 1) "(x * 3 + " k ")" : "x"
+            print "fn hot_" k "(x: i32): i32 {"
+            print "    return if (cppl_eq(x % 7, 9)) { fail_" k "(x) } else { " next_call " };"
+            print "}"
+            print "fn fail_" k "(x: i32): i32 {"
+            print "    cppl_fail(x);"
+            print "    let v0: i32 = x * " k " + 1;"
+            for (i = 1; i < 40; i++) print "    let v" i ": i32 = v" (i - 1) " * " (i + k) " + x / " (i + 1) ";"
+            print "    return v39;"
+            print "}"
+        }
+        print "fn walk(i: i32, n: i32, acc: i32): i32 {"
+        print "    return if (cppl_lt(i, n)) { walk(i + 1, n, acc + hot_0(i)) } else { acc };"
+        print "}"
+        print "fn blocks(b: i32, n: i32, acc: i32): i32 {"
+        print "    return if (cppl_lt(b, n)) { blocks(b + 1, n, walk(0, 1000, acc)) } else { acc };"
+        print "}"
+        print "fn main(): i32 {"
+        print "    cppl_print(blocks(0, 100, 0));"
+        print "    return 0;"
+        print "}"
+    }'
+}
+
+generate "" > "$workdir/plain.cppl"
+generate cold > "$workdir/cold.cppl"
+"$cc" -O2 -c "$here/runtime/support.c" -o "$workdir/support.o" || exit 1
+
+# -O1, so that the chain isn't inlined into one function
+build() {
+    "$cppl" -O1 "$@" -o "$workdir/out.o" && "$cc" -o "$workdir/$name" "$workdir/out.o" "$workdir/support.o"
+}
+
+name=plain; build "$workdir/plain.cppl" || exit 1
+name=cold; build "$workdir/cold.cppl" || exit 1
+
+# Order the functions entered while profiling, leaving out the error paths
+name=profiled; build -fprofile-generate="$workdir/prof" "$workdir/plain.cppl" || exit 1
+"$workdir/profiled" > /dev/null || exit 1
+awk '$4 > 0 && ! seen[$1]++ { print $1 }' "$workdir/prof" > "$workdir/order.txt"
+name=ordered; build --symbol-ordering-file="$workdir/order.txt" "$workdir/plain.cppl" || exit 1
+
+for name in plain cold ordered; do
+    echo "== $name"
+    perf stat -e instructions,L1-icache-load-misses,iTLB-load-misses "$workdir/$name" 2>&1 > /dev/null |
+        grep -E "instructions|misses"
+done
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Profile one of the runtime benchmarks with perf, and report the hottest
+# source lines, to check that debug info attributes samples correctly.
+#
+# Usage: perf_lines.sh [path to cppl] [benchmark] [-g | -gline-tables-only]
+
+cppl=${1:-../cppl}
+name=${2:-collatz}
+debug=${3:--g}
+cc=${CC:-clang}
+
+here=$(cd "$(dirname "$0")" && pwd)
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+"$cc" -O2 -g -c "$here/runtime/support.c" -o "$workdir/support.o" || exit 1
+"$cppl" -O2 "$debug" "$here/runtime/$name.cppl" -o "$workdir/$name.o" || exit 1
+"$cc" -o "$workdir/$name" "$workdir/$name.o" "$workdir/support.o" || exit 1
+
+perf record -q -o "$workdir/perf.data" "$workdir/$name" > /dev/null || exit 1
+perf report -i "$workdir/perf.data" --stdio --sort srcline 2> /dev/null | head -n 30
@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <stdio.h>
+
+static uint32_t mix(uint32_t x, uint32_t acc) {
+    if (x % 3 == 0) {
+        uint32_t a = x * 7 + acc;
+        uint32_t b = a % 1009;
+        return b + x;
+    } else if (x % 3 == 1) {
+        uint32_t c = acc * 31 + x;
+        uint32_t d = c % 2003;
+        return d;
+    } else {
+        uint32_t e = acc + x * x;
+        uint32_t f = e % 4001;
+        return f + 1;
+    }
+}
+
+// branchy.cppl declares its locals inside if branches, and recurses over
+// blocks of 10000 steps, so that its stack use depends on the size of the
+// frames of mix and walk when nothing is optimized.
+int main(void) {
+    uint32_t acc = 0;
+    for (uint32_t x = 0; x < 10000000; x++) {
+        acc = mix(x, acc);
+    }
+    printf("%u\n", acc);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#include <stdint.h>
+#include <stdio.h>
+
+static uint32_t steps(uint32_t x) {
+    uint32_t n = 0;
+    while (x != 1) {
+        x = x % 2 == 0 ? x / 2 : 3 * x + 1;
+        n++;
+    }
+    return n;
+}
+
+// Every trajectory starting below 100000 stays within 32 bits. collatz.cppl
+// recurses over blocks of 1000 starting points, to keep its stack shallow
+// when nothing is optimized.
+int main(void) {
+    uint32_t acc = 0;
+    for (uint32_t x = 0; x < 1000000; x++) {
+        acc += steps(x % 100000 + 1);
+    }
+    printf("%u\n", acc);
+    return 0;
+}
@@ -0,0 +1,11 @@
+#include <stdint.h>
+#include <stdio.h>
+
+static uint32_t fib(uint32_t n) {
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+int main(void) {
+    printf("%u\n", fib(35));
+    return 0;
+}
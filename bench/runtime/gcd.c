@@ -0,0 +1,17 @@
+#include <stdint.h>
+#include <stdio.h>
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    return b == 0 ? a : gcd(b, a % b);
+}
+
+int main(void) {
+    uint32_t acc = 0;
+    for (uint32_t i = 1; i <= 2000; i++) {
+        for (uint32_t j = 1; j <= 2000; j++) {
+            acc += gcd(i, j);
+        }
+    }
+    printf("%u\n", acc);
+    return 0;
+}
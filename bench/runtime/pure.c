@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// Nothing but the arguments decides the result, so the calls in the loop
+// below can be merged and hoisted out of it
+static uint32_t weight(uint32_t n, uint32_t acc) {
+    for (; n >= 1; n--) {
+        acc = acc * 31 + n;
+    }
+    return acc;
+}
+
+int main(void) {
+    uint32_t acc = 0;
+    for (int block = 0; block < 100; block++) {
+        for (uint32_t i = 0; i < 1000; i++) {
+            acc += weight(500, 0) * i + weight(500, 0);
+        }
+    }
+    printf("%u\n", acc);
+    return 0;
+}
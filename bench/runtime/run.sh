@@ -0,0 +1,110 @@
+#!/bin/sh
+# Build each runtime benchmark with cppl at every -O level, and its C
+# reference with clang -O2. Check that every build prints the same result,
+# and report the best wall time of each build relative to the C reference,
+# and its peak RSS. The cppl programs recurse where the C ones loop, so
+# their peak RSS is mostly stack, and grows with the size of their frames.
+#
+# The cppl programs call helpers in support.c for comparisons and string
+# access, which the language does not have yet, so the ratios include the
+# cost of those calls.
+#
+# Each benchmark is also built at -O2 with -fno-specialize, to measure what
+# specializing functions on their constant arguments gains.
+#
+# If CPPLRT is set to the path of libcpplrt.a, each benchmark is also built
+# at -O2 with -finstrument=profile, to measure the cost of instrumenting.
+#
+# Usage: run.sh [path to cppl] [runs]
+
+cppl=${1:-../../cppl}
+runs=${2:-5}
+cc=${CC:-clang}
+
+here=$(cd "$(dirname "$0")" && pwd)
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+"$cc" -O2 -c "$here/support.c" -o "$workdir/support.o" || exit 1
+
+# The best wall time of $runs runs of a program, in seconds
+best_time() {
+    best=
+    for i in $(seq $runs); do
+        start=$(date +%s.%N)
+        "$1" > /dev/null
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; print ($3 == "" || t < $3) ? t : $3 }')
+    done
+    echo $best
+}
+
+# The peak RSS of a program, in KB, as reported by support.c
+max_rss() {
+    CPPL_BENCH_RSS=1 "$1" 2>&1 > /dev/null | tail -n 1
+}
+
+report() {
+    echo "$1 $2 $3 $4 $(max_rss "$5")" |
+        awk '{ printf "%-10s %-9s %9.3f %7.2f %9d\n", $1, $2, $3, $3 / $4, $5 }'
+}
+
+exit_status=0
+
+printf "%-10s %-9s %9s %7s %9s\n" benchmark build seconds ratio "RSS (KB)"
+for src in "$here"/*.cppl; do
+    name=$(basename "$src" .cppl)
+
+    if ! "$cc" -O2 -o "$workdir/$name.c.out" "$here/$name.c" "$workdir/support.o"; then
+        echo "BUILD OF $name.c FAILED" >&2
+        exit_status=$((exit_status + 1))
+        continue
+    fi
+    expected=$("$workdir/$name.c.out")
+    baseline=$(best_time "$workdir/$name.c.out")
+    report "$name" "$cc-O2" "$baseline" "$baseline" "$workdir/$name.c.out"
+
+    for level in 0 1 2 3; do
+        obj="$workdir/$name.O$level.o"
+        exe="$workdir/$name.O$level.out"
+
+        if ! "$cppl" -O$level "$src" -o "$obj" || ! "$cc" -o "$exe" "$obj" "$workdir/support.o"; then
+            echo "BUILD OF $name AT -O$level FAILED" >&2
+            exit_status=$((exit_status + 1))
+            continue
+        fi
+        if [ "$("$exe")" != "$expected" ]; then
+            echo "$name AT -O$level PRINTED THE WRONG RESULT" >&2
+            exit_status=$((exit_status + 1))
+            continue
+        fi
+
+        report "$name" "cppl-O$level" "$(best_time "$exe")" "$baseline" "$exe"
+    done
+
+    obj="$workdir/$name.nospec.o"
+    exe="$workdir/$name.nospec.out"
+    if ! "$cppl" -O2 -fno-specialize "$src" -o "$obj" || ! "$cc" -o "$exe" "$obj" "$workdir/support.o"; then
+        echo "BUILD OF $name WITHOUT SPECIALIZATION FAILED" >&2
+        exit_status=$((exit_status + 1))
+    elif [ "$("$exe")" != "$expected" ]; then
+        echo "$name WITHOUT SPECIALIZATION PRINTED THE WRONG RESULT" >&2
+        exit_status=$((exit_status + 1))
+    else
+        report "$name" "nospec-O2" "$(best_time "$exe")" "$baseline" "$exe"
+    fi
+
+    if [ -n "$CPPLRT" ]; then
+        obj="$workdir/$name.instr.o"
+        exe="$workdir/$name.instr.out"
+        if ! "$cppl" -O2 -finstrument=profile "$src" -o "$obj" ||
+                ! "$cc" -o "$exe" "$obj" "$workdir/support.o" "$CPPLRT" -lpthread; then
+            echo "INSTRUMENTED BUILD OF $name FAILED" >&2
+            exit_status=$((exit_status + 1))
+            continue
+        fi
+        (cd "$workdir" && report "$name" "instr-O2" "$(best_time "$exe")" "$baseline" "$exe")
+    fi
+done
+
+exit $exit_status
@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <stdio.h>
+
+static uint32_t step(uint32_t x, uint32_t acc) {
+    uint32_t picked;
+    if (x % 2 == 0) {
+        uint32_t a = x * 3 + acc;
+        picked = a % 10007;
+    } else {
+        uint32_t b = acc * 7 + x;
+        picked = b % 10009;
+    }
+    uint32_t c = picked * 5 + x;
+    uint32_t d = c % 65521;
+    return d + picked;
+}
+
+// slots.cppl declares locals at the top level of step after an if whose
+// branches declare their own, so that the top level ones are given slots
+// after the branch slots have been freed.
+int main(void) {
+    uint32_t acc = 0;
+    for (uint32_t x = 0; x < 10000000; x++) {
+        acc = step(x, acc);
+    }
+    printf("%u\n", acc);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <stdio.h>
+
+static uint32_t step(uint32_t x, uint32_t acc, int square, uint32_t scale) {
+    if (square) {
+        return (acc + x * x) % scale;
+    } else {
+        return (acc * scale + x) % 65521;
+    }
+}
+
+static uint32_t walk(uint32_t x, uint32_t end, uint32_t acc, int square, uint32_t scale) {
+    for (; x < end; x++) {
+        acc = step(x, acc, square, scale);
+    }
+    return acc;
+}
+
+// specialize.cppl passes walk a different mode and modulus from each of its
+// two calls, so that LLVM can't propagate them into the shared function,
+// and its speed depends on -fspecialize cloning walk and step for each.
+int main(void) {
+    uint32_t acc = 0;
+    for (uint32_t block = 0; block < 1000; block++) {
+        acc = walk(block * 10000, block * 10000 + 10000, acc, 1, 4099);
+        acc = walk(block * 10000, block * 10000 + 10000, acc, 0, 7);
+    }
+    printf("%u\n", acc);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t hash(const char *s, size_t n, uint32_t h) {
+    for (size_t i = 0; i < n; i++) {
+        h = h * 31 + (unsigned char)s[i];
+    }
+    return h;
+}
+
+int main(void) {
+    const char *s = "The quick brown fox jumps over the lazy dog, then naps in the warm afternoon sun.";
+    size_t n = strlen(s);
+    uint32_t h = 7;
+    for (int i = 0; i < 250 * 1000; i++) {
+        h = hash(s, n, h);
+    }
+    printf("%u\n", h);
+    return 0;
+}
@@ -0,0 +1,51 @@
+// Helpers which the cppl benchmarks call through FFI, for the operations
+// that the language does not have yet.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+// The layout of a cppl string
+struct cppl_string {
+    const char *data;
+    size_t length;
+};
+
+bool cppl_lt(uint32_t a, uint32_t b) {
+    return a < b;
+}
+
+bool cppl_eq(uint32_t a, uint32_t b) {
+    return a == b;
+}
+
+uint32_t cppl_print(uint32_t x) {
+    printf("%u\n", x);
+    return 0;
+}
+
+// Reports an error the program can't recover from
+uint32_t cppl_fail(uint32_t code) {
+    fprintf(stderr, "failed with %u\n", code);
+    exit(1);
+}
+
+uint32_t cppl_length(struct cppl_string s) {
+    return s.length;
+}
+
+uint32_t cppl_byte(struct cppl_string s, uint32_t i) {
+    return (unsigned char)s.data[i];
+}
+
+// run.sh sets CPPL_BENCH_RSS to have each program report its peak RSS, in
+// KB, which deep recursion makes mostly stack
+__attribute__((destructor)) static void report_rss(void) {
+    if (getenv("CPPL_BENCH_RSS") == NULL) return;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "%ld\n", usage.ru_maxrss);
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Compare compiling N small files with fresh cppl processes against sending
+# them to a warm compile server.
+#
+# Usage: server_bench.sh [path to cppl] [N]
+
+cppl=${1:-../cppl}
+count=${2:-200}
+
+workdir=$(mktemp -d)
+socket="$workdir/cppl.sock"
+trap 'kill $server_pid 2> /dev/null; rm -rf "$workdir"' EXIT
+
+for i in $(seq $count); do
+    cat > "$workdir/small$i.cppl" <<CPPL
+FFI fn putchar(chr: i32): i32;
+
+fn f$i(x: i32): i32 {
+    return x * $i + 1;
+}
+
+fn main(): i32 {
+    putchar(f$i(2));
+    return 0;
+}
+CPPL
+done
+
+compile_all() {
+    for i in $(seq $count); do
+        "$cppl" "$@" "$workdir/small$i.cppl" "$workdir/small$i.o" > /dev/null || exit 1
+    done
+}
+
+echo "Fresh processes ($count files):"
+time compile_all
+
+"$cppl" --server="$socket" &
+server_pid=$!
+while [ ! -S "$socket" ]; do sleep 0.05; done
+
+echo "Compile server ($count files):"
+time compile_all --connect="$socket"
@@ -0,0 +1,26 @@
+# Writes OUTPUT, defining CPPL_BUILD_ID as a hash of the compiler's sources
+# and of the flags they are compiled with. The object cache and the
+# incremental database are keyed by it, so that they are invalidated
+# whenever the compiler changes. The file is only rewritten when the hash
+# does, so that unchanged builds don't recompile what includes it.
+#
+# Usage: cmake -DSOURCE_DIR=<dir> -DOUTPUT=<file> -DFLAGS=<flags> -P BuildId.cmake
+
+file(GLOB sources ${SOURCE_DIR}/src/*.cpp ${SOURCE_DIR}/src/*.h)
+list(SORT sources)
+
+set(hashes "${FLAGS}")
+foreach(source ${sources})
+    file(MD5 ${source} hash)
+    set(hashes "${hashes}${hash}")
+endforeach()
+string(MD5 id "${hashes}")
+
+set(content "#define CPPL_BUILD_ID \"${id}\"\n")
+set(old "")
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} old)
+endif()
+if(NOT old STREQUAL content)
+    file(WRITE ${OUTPUT} "${content}")
+endif()
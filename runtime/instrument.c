@@ -0,0 +1,237 @@
+// The runtime for -finstrument=profile. Generated code calls
+// __cppl_instrument_enter when a function starts and __cppl_instrument_exit
+// before it returns. Each thread keeps its own counts, and at exit they are
+// added up into a report of the top functions and call graph edges.
+//
+// The report goes to cppl-instrument.txt, or $CPPL_INSTRUMENT_FILE, and
+// lists $CPPL_INSTRUMENT_TOP (default 20) functions and edges.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+// One per instrumented function, emitted by the compiler. The id is given
+// out the first time the function is entered.
+struct cppl_fn_record {
+    const char *name;
+    uint32_t id;
+};
+
+struct frame {
+    uint32_t id;
+    uint64_t start;
+    uint64_t children; // Cycles spent in calls made by this frame
+};
+
+struct fn_stats {
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+    uint32_t active; // Frames of this function on the stack, for recursion
+};
+
+struct edge {
+    uint64_t key; // caller id << 32 | callee id, 0 when empty
+    uint64_t calls;
+};
+
+struct thread_data {
+    struct frame *frames;
+    size_t depth, framesCap;
+
+    struct fn_stats *stats;
+    size_t statsCap;
+
+    struct edge *edges;
+    size_t edgeCount, edgesCap; // edgesCap is a power of two
+
+    struct thread_data *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_data *threads;
+static const char **names; // By id
+static uint32_t nextId = 1;
+static size_t namesCap;
+
+static __thread struct thread_data *current;
+
+static void *grow(void *array, size_t *cap, size_t needed, size_t size) {
+    size_t newCap = *cap ? *cap : 64;
+    while (newCap <= needed) newCap *= 2;
+    array = realloc(array, newCap * size);
+    if (array == NULL) abort();
+    memset((char *)array + *cap * size, 0, (newCap - *cap) * size);
+    *cap = newCap;
+    return array;
+}
+
+static struct thread_data *threadData(void) {
+    struct thread_data *td = calloc(1, sizeof(struct thread_data));
+    if (td == NULL) abort();
+
+    pthread_mutex_lock(&lock);
+    td->next = threads;
+    threads = td;
+    pthread_mutex_unlock(&lock);
+
+    current = td;
+    return td;
+}
+
+static uint32_t assignId(struct cppl_fn_record *fn) {
+    pthread_mutex_lock(&lock);
+    if (fn->id == 0) {
+        if (nextId >= namesCap) names = grow(names, &namesCap, nextId, sizeof(*names));
+        names[nextId] = fn->name;
+        __atomic_store_n(&fn->id, nextId++, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lock);
+    return fn->id;
+}
+
+static struct edge *findEdge(struct edge *edges, size_t cap, uint64_t key) {
+    size_t i = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+    for (;; i++) {
+        struct edge *e = &edges[i & (cap - 1)];
+        if (e->key == key || e->key == 0) return e;
+    }
+}
+
+static void countEdge(struct thread_data *td, uint32_t caller, uint32_t callee) {
+    if (2 * (td->edgeCount + 1) > td->edgesCap) {
+        // Rehash into a table twice the size
+        size_t oldCap = td->edgesCap;
+        size_t newCap = oldCap ? 2 * oldCap : 256;
+        struct edge *edges = calloc(newCap, sizeof(struct edge));
+        if (edges == NULL) abort();
+        for (size_t i = 0; i < oldCap; i++) {
+            if (td->edges[i].key != 0) *findEdge(edges, newCap, td->edges[i].key) = td->edges[i];
+        }
+        free(td->edges);
+        td->edges = edges;
+        td->edgesCap = newCap;
+    }
+
+    uint64_t key = (uint64_t)caller << 32 | callee;
+    struct edge *e = findEdge(td->edges, td->edgesCap, key);
+    if (e->key == 0) {
+        e->key = key;
+        td->edgeCount++;
+    }
+    e->calls++;
+}
+
+void __cppl_instrument_enter(struct cppl_fn_record *fn) {
+    struct thread_data *td = current ? current : threadData();
+    uint32_t id = __atomic_load_n(&fn->id, __ATOMIC_ACQUIRE);
+    if (id == 0) id = assignId(fn);
+
+    if (id >= td->statsCap) td->stats = grow(td->stats, &td->statsCap, id, sizeof(struct fn_stats));
+    if (td->depth >= td->framesCap) td->frames = grow(td->frames, &td->framesCap, td->depth, sizeof(struct frame));
+
+    td->stats[id].calls++;
+    td->stats[id].active++;
+    countEdge(td, td->depth ? td->frames[td->depth - 1].id : 0, id);
+
+    struct frame *f = &td->frames[td->depth++];
+    f->id = id;
+    f->children = 0;
+    f->start = __rdtsc();
+}
+
+void __cppl_instrument_exit(void) {
+    uint64_t now = __rdtsc();
+    struct thread_data *td = current;
+    if (td == NULL || td->depth == 0) return;
+
+    struct frame *f = &td->frames[--td->depth];
+    uint64_t elapsed = now - f->start;
+    struct fn_stats *stats = &td->stats[f->id];
+
+    stats->exclusive += elapsed - f->children;
+    // A recursive function's time is only counted once, by its outermost frame
+    if (--stats->active == 0) stats->inclusive += elapsed;
+    if (td->depth) td->frames[td->depth - 1].children += elapsed;
+}
+
+static int byExclusive(const void *a, const void *b) {
+    const struct fn_stats *x = *(const struct fn_stats * const *)a;
+    const struct fn_stats *y = *(const struct fn_stats * const *)b;
+    return x->exclusive < y->exclusive ? 1 : x->exclusive > y->exclusive ? -1 : 0;
+}
+
+static int byCalls(const void *a, const void *b) {
+    const struct edge *x = a, *y = b;
+    return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : 0;
+}
+
+static const char *nameOf(uint32_t id) {
+    return id == 0 ? "<root>" : names[id];
+}
+
+__attribute__((destructor))
+static void report(void) {
+    pthread_mutex_lock(&lock);
+    uint32_t count = nextId;
+
+    // Add up the threads
+    struct fn_stats *total = calloc(count, sizeof(struct fn_stats));
+    struct edge *edges = NULL;
+    size_t edgeCount = 0, edgesCap = 0;
+    for (struct thread_data *td = threads; td != NULL; td = td->next) {
+        for (size_t i = 0; i < td->statsCap && i < count; i++) {
+            total[i].calls += td->stats[i].calls;
+            total[i].inclusive += td->stats[i].inclusive;
+            total[i].exclusive += td->stats[i].exclusive;
+        }
+        for (size_t i = 0; i < td->edgesCap; i++) {
+            if (td->edges[i].key == 0) continue;
+            size_t j;
+            for (j = 0; j < edgeCount && edges[j].key != td->edges[i].key; j++) {}
+            if (j == edgeCount) {
+                if (edgeCount >= edgesCap) edges = grow(edges, &edgesCap, edgeCount, sizeof(struct edge));
+                edges[edgeCount++].key = td->edges[i].key;
+            }
+            edges[j].calls += td->edges[i].calls;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    const char *path = getenv("CPPL_INSTRUMENT_FILE");
+    const char *top = getenv("CPPL_INSTRUMENT_TOP");
+    size_t limit = top ? strtoul(top, NULL, 10) : 20;
+
+    FILE *out = fopen(path ? path : "cppl-instrument.txt", "w");
+    if (out == NULL || total == NULL) return;
+
+    struct fn_stats **sorted = malloc(count * sizeof(*sorted));
+    size_t used = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        if (total[i].calls) sorted[used++] = &total[i];
+    }
+    qsort(sorted, used, sizeof(*sorted), byExclusive);
+
+    fprintf(out, "%-32s %12s %16s %16s\n", "function", "calls", "inclusive", "exclusive");
+    for (size_t i = 0; i < used && i < limit; i++) {
+        fprintf(out, "%-32s %12llu %16llu %16llu\n", names[sorted[i] - total],
+                (unsigned long long)sorted[i]->calls,
+                (unsigned long long)sorted[i]->inclusive,
+                (unsigned long long)sorted[i]->exclusive);
+    }
+
+    qsort(edges, edgeCount, sizeof(struct edge), byCalls);
+    fprintf(out, "\n%-32s %-32s %12s\n", "caller", "callee", "calls");
+    for (size_t i = 0; i < edgeCount && i < limit; i++) {
+        fprintf(out, "%-32s %-32s %12llu\n", nameOf(edges[i].key >> 32), nameOf((uint32_t)edges[i].key),
+                (unsigned long long)edges[i].calls);
+    }
+
+    fclose(out);
+    free(sorted);
+    free(edges);
+    free(total);
+}
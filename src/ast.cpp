@@ -193,6 +193,8 @@ void EmptyStmt::accept(StmtVisitor &visitor) { visitor.visit(this); }
  *********/
 
 std::ostream& FunctionItem::show(std::ostream &os) {
+    if (exported) os << "pub ";
+    if (cold) os << "cold ";
     os << "fn " << proto.name << "(";
     bool first = true;
     for (auto i = proto.arguments.begin(); i != proto.arguments.end(); i++) {
@@ -221,7 +223,11 @@ std::ostream& StructItem::show(std::ostream &os) {
 void StructItem::accept(ItemVisitor &visitor) { visitor.visit(this); }
 
 std::ostream& FFIFunctionItem::show(std::ostream &os) {
-    os << "FFI fn " << proto.name << "(";
+    os << "FFI ";
+    if (purity == PURITY_PURE) os << "pure ";
+    if (purity == PURITY_CONST) os << "const ";
+    if (cold) os << "cold ";
+    os << "fn " << proto.name << "(";
     bool first = true;
     for (auto i = proto.arguments.begin(); i != proto.arguments.end(); i++) {
         if (first) first = false; else os << ", ";
@@ -12,6 +12,7 @@
 #include <memory>
 #include <vector>
 #include "lexer.h"
+#include "stats.h"
 
 class Expr;
 class Stmt;
@@ -41,6 +42,7 @@ public:
     istr name;
     std::vector<Argument> arguments;
     Type returnType;
+    SourceLoc loc;
 };
 
 class Branch {
@@ -57,6 +59,11 @@ public:
 class ExprVisitor;
 class Expr {
 public:
+    COUNT_ALLOCATIONS(ALLOC_AST)
+
+    SourceLoc loc; // Where the expression starts
+
+    virtual ~Expr() {}
     virtual std::ostream& show(std::ostream& os) = 0;
     virtual void accept(ExprVisitor &visitor) = 0;
 };
@@ -187,6 +194,11 @@ public:
 class StmtVisitor;
 class Stmt {
 public:
+    COUNT_ALLOCATIONS(ALLOC_AST)
+
+    SourceLoc loc;
+
+    virtual ~Stmt() {}
     virtual std::ostream& show(std::ostream& os) = 0;
     virtual void accept(StmtVisitor &visitor) = 0;
 };
@@ -242,6 +254,9 @@ public:
 class ItemVisitor;
 class Item {
 public:
+    COUNT_ALLOCATIONS(ALLOC_AST)
+
+    virtual ~Item() {}
     virtual std::ostream& show(std::ostream& os) = 0;
     virtual void accept(ItemVisitor &visitor) = 0;
 };
@@ -250,10 +265,13 @@ std::ostream& operator<<(std::ostream& os, Item &stmt);
 
 class FunctionItem : public Item {
 public:
-    FunctionItem(FunctionProto proto, std::vector<std::unique_ptr<Stmt>> body)
-        : proto(proto), body(std::move(body)) {};
+    FunctionItem(FunctionProto proto, std::vector<std::unique_ptr<Stmt>> body, bool exported = false,
+                 bool cold = false)
+        : proto(proto), body(std::move(body)), exported(exported), cold(cold) {};
     FunctionProto proto;
     std::vector<std::unique_ptr<Stmt>> body;
+    bool exported; // Declared `pub fn`
+    bool cold;     // Declared `cold fn`: rarely called
     virtual std::ostream& show(std::ostream& os);
     virtual void accept(ItemVisitor &visitor);
 };
@@ -267,10 +285,20 @@ public:
     virtual void accept(ItemVisitor &visitor);
 };
 
+// What an FFI function may do to memory, as annotated in its declaration
+enum FFIPurity {
+    PURITY_NONE,  // Anything
+    PURITY_PURE,  // Read memory, but not write it
+    PURITY_CONST  // Depend on nothing but its arguments
+};
+
 class FFIFunctionItem : public Item {
 public:
-    FFIFunctionItem(FunctionProto proto) : proto(proto) {};
+    FFIFunctionItem(FunctionProto proto, FFIPurity purity = PURITY_NONE, bool cold = false)
+        : proto(proto), purity(purity), cold(cold) {};
     FunctionProto proto;
+    FFIPurity purity;
+    bool cold;
     virtual std::ostream& show(std::ostream& os);
     virtual void accept(ItemVisitor &visitor);
 };
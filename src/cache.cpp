@@ -0,0 +1,244 @@
+#include "cache.h"
+#include "cppl_build_id.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MD5.h>
+
+// Changing the compiler changes its output, so a hash of its sources and
+// flags (see cmake/BuildId.cmake) is part of its identity as far as the
+// cache is concerned
+const char *compilerVersion = "cppl " CPPL_BUILD_ID " llvm " LLVM_VERSION_STRING;
+
+// The umask can only be read by setting it, which would race with threads
+// creating files, so it is read once, before main
+static mode_t readUmask() {
+    mode_t mask = umask(0);
+    umask(mask);
+    return mask;
+}
+static const mode_t processUmask = readUmask();
+
+mode_t newFileMode() {
+    return 0666 & ~processUmask;
+}
+
+// Holds an exclusive lock on the cache's lock file while in scope. Stats
+// updates and eviction are serialized with it; lookups and stores don't
+// need it, as entries are only ever created by rename.
+struct CacheLock {
+    int fd;
+
+    explicit CacheLock(const std::string &dir) {
+        fd = open((dir + "/lock").c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd >= 0) flock(fd, LOCK_EX);
+    }
+
+    ~CacheLock() {
+        if (fd >= 0) close(fd);
+    }
+};
+
+static bool readFile(const std::string &path, std::string &data) {
+    std::ifstream file(path, std::ios::binary);
+    if (! file) return false;
+    std::ostringstream ss;
+    ss << file.rdbuf();
+    data = ss.str();
+    return true;
+}
+
+// Copy from to to, by way of a temporary file in the directory of to, so
+// that nobody ever sees a partially written file
+static bool copyAtomically(const std::string &from, const std::string &to) {
+    std::string tmp = to + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) return false;
+    fchmod(fd, newFileMode());
+    close(fd);
+
+    {
+        std::ifstream in(from, std::ios::binary);
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out << in.rdbuf();
+        if (! in || ! out) {
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+
+    if (rename(tmp.c_str(), to.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+ObjectCache::ObjectCache(const std::string &dir, uint64_t maxSize) : dir(dir), maxSize(maxSize) {
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/objects").c_str(), 0755);
+}
+
+std::string ObjectCache::objectPath(const std::string &key) {
+    return dir + "/objects/" + key;
+}
+
+std::string ObjectCache::key(const Options &opts) {
+    llvm::MD5 hash;
+    auto add = [&](const std::string &str) {
+        // Include the length so that adjacent fields can't run together
+        hash.update(std::to_string(str.size()) + ":");
+        hash.update(str);
+    };
+
+    add(compilerVersion);
+    add(llvm::sys::getDefaultTargetTriple());
+    add(llvm::sys::getHostCPUName().str());
+    add(std::to_string(opts.optLevel));
+    // Each output is stored under the key plus its extension, so the key
+    // doesn't depend on --emit
+    add(opts.lto ? "lto" : "");
+    add(std::to_string(opts.codegenThreads));
+    add(opts.incrementalDir.empty() ? "" : "incremental");
+    add(opts.stream ? "stream" : "");
+    add(std::to_string(opts.debugInfo));
+    add(opts.profileGenerate);
+    add(opts.instrument ? "instrument" : "");
+    add(wantsSpecialize(opts) ? "specialize" : "");
+
+    for (auto path : { &opts.profileUse, &opts.symbolOrderingFile }) {
+        if (! path->empty()) {
+            std::string data;
+            if (! readFile(*path, data)) return "";
+            add(data);
+        } else {
+            add("");
+        }
+    }
+
+    for (auto &input : opts.inputs) {
+        std::string data;
+        if (! readFile(input, data)) return "";
+        // The extension decides how the input is loaded, and debug info
+        // records where it is
+        add(opts.debugInfo != 0 ? input : input.substr(input.find_last_of('.') + 1));
+        add(data);
+    }
+
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    llvm::SmallString<32> str;
+    llvm::MD5::stringifyResult(result, str);
+    return str.str().str();
+}
+
+bool ObjectCache::fetch(const std::string &key, const std::string &output) {
+    auto path = objectPath(key);
+
+    // Another process may evict the entry at any time, in which case this is a miss
+    bool hit = copyAtomically(path, output);
+    if (hit) {
+        // Mark the entry as recently used
+        utimes(path.c_str(), NULL);
+    }
+
+    bumpStat(hit);
+    return hit;
+}
+
+void ObjectCache::store(const std::string &key, const std::string &output) {
+    if (! copyAtomically(output, objectPath(key))) return;
+    evict();
+}
+
+void ObjectCache::bumpStat(bool hit) {
+    CacheLock lock(dir);
+
+    uint64_t hits = 0, misses = 0;
+    std::ifstream in(dir + "/stats");
+    std::string name;
+    uint64_t value;
+    while (in >> name >> value) {
+        if (name == "hits") hits = value;
+        if (name == "misses") misses = value;
+    }
+    in.close();
+
+    (hit ? hits : misses)++;
+
+    std::ofstream out(dir + "/stats", std::ios::trunc);
+    out << "hits " << hits << "\nmisses " << misses << "\n";
+}
+
+struct CacheEntry {
+    std::string path;
+    uint64_t size;
+    time_t mtime;
+};
+
+static std::vector<CacheEntry> listEntries(const std::string &objects) {
+    std::vector<CacheEntry> entries;
+
+    DIR *d = opendir(objects.c_str());
+    if (d == NULL) return entries;
+    while (struct dirent *ent = readdir(d)) {
+        if (ent->d_name[0] == '.') continue;
+
+        auto path = objects + "/" + ent->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            entries.push_back({ path, (uint64_t) st.st_size, st.st_mtime });
+        }
+    }
+    closedir(d);
+
+    return entries;
+}
+
+void ObjectCache::evict() {
+    CacheLock lock(dir);
+
+    auto entries = listEntries(dir + "/objects");
+    uint64_t total = 0;
+    for (auto &entry : entries) total += entry.size;
+    if (total <= maxSize) return;
+
+    // Evict down to 90% of the limit, so that we don't have to scan the
+    // directory again on the very next store
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) {
+        return a.mtime < b.mtime;
+    });
+    for (auto &entry : entries) {
+        if (total <= maxSize / 10 * 9) break;
+        if (unlink(entry.path.c_str()) == 0) total -= entry.size;
+    }
+}
+
+void ObjectCache::printStats(std::ostream &os) {
+    CacheLock lock(dir);
+
+    std::string stats;
+    readFile(dir + "/stats", stats);
+
+    auto entries = listEntries(dir + "/objects");
+    uint64_t total = 0;
+    for (auto &entry : entries) total += entry.size;
+
+    os << "cache directory " << dir << "\n"
+       << stats
+       << "entries " << entries.size() << "\n"
+       << "size " << total << " (limit " << maxSize << ")\n";
+}
@@ -0,0 +1,53 @@
+//
+//  cache.h
+//  cppl
+//
+//  A content addressed cache of compiler outputs, shared between cppl
+//  processes. Entries are keyed by a hash of the inputs, the compiler and
+//  the flags; the cache is kept under a size limit by evicting the least
+//  recently used entries.
+//
+
+#ifndef __cppl__cache__
+#define __cppl__cache__
+
+#include "options.h"
+
+#include <iostream>
+#include <string>
+
+#include <sys/types.h>
+
+// Identifies the build of the compiler, whose outputs can't be reused by another
+extern const char *compilerVersion;
+
+// The mode open() would give a new file: 0666 less the umask. Files made
+// with mkstemp are 0600, so outputs written through one are given this.
+mode_t newFileMode();
+
+struct ObjectCache {
+    std::string dir;
+    uint64_t maxSize;
+
+    ObjectCache(const std::string &dir, uint64_t maxSize);
+
+    // The key of the output opts would produce, or "" if the inputs
+    // can't be read
+    std::string key(const Options &opts);
+
+    // Copy the entry for key to output. Returns false on a miss.
+    bool fetch(const std::string &key, const std::string &output);
+
+    // Add output to the cache as the entry for key, evicting old entries
+    // if the cache has grown too large
+    void store(const std::string &key, const std::string &output);
+
+    void printStats(std::ostream &os);
+
+private:
+    std::string objectPath(const std::string &key);
+    void bumpStat(bool hit);
+    void evict();
+};
+
+#endif /* defined(__cppl__cache__) */
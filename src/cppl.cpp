@@ -0,0 +1,53 @@
+#include "cppl.h"
+#include "driver.h"
+
+#include <iostream>
+#include <streambuf>
+
+// Passes what is written to it on to a diagnostic callback, a line at a time
+struct DiagnosticBuffer : public std::streambuf {
+    const std::function<void(const std::string &)> &handler;
+    std::string line;
+
+    DiagnosticBuffer(const std::function<void(const std::string &)> &handler) : handler(handler) {}
+
+    ~DiagnosticBuffer() {
+        if (! line.empty()) handler(line);
+    }
+
+    virtual int overflow(int c) {
+        if (c == '\n') {
+            handler(line);
+            line.clear();
+        } else if (c != EOF) {
+            line += (char) c;
+        }
+        return c;
+    }
+};
+
+CpplCompiler::CpplCompiler() : cc(std::make_unique<CompilerContext>()) {
+    initializeLLVM();
+}
+
+CpplCompiler::~CpplCompiler() {}
+
+bool CpplCompiler::compile(const std::string &source, const CpplOptions &options, std::string &out) {
+    Options opts;
+    opts.optLevel = options.optLevel;
+    opts.debugInfo = options.debugInfo;
+    opts.specialize = options.specialize;
+
+    llvm::SmallVector<char, 0> buffer;
+    bool ok;
+    if (options.diagnostic) {
+        DiagnosticBuffer diagBuffer(options.diagnostic);
+        std::ostream diag(&diagBuffer);
+        ok = compileBuffer(*cc, opts, source, options.sourceName, options.emit, buffer, diag);
+    } else {
+        ok = compileBuffer(*cc, opts, source, options.sourceName, options.emit, buffer, std::cerr);
+    }
+
+    out.assign(buffer.data(), buffer.size());
+    return ok;
+}
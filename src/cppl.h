@@ -0,0 +1,56 @@
+//
+//  cppl.h
+//  cppl
+//
+//  The compiler as a library (libcppl.a and libcppl.so), for tools which
+//  compile many small sources and can't afford a process for each. A
+//  CpplCompiler compiles cppl source held in memory into an object,
+//  assembly, IR or bitcode buffer without touching the filesystem.
+//
+//  LLVM is initialized once, by the first CpplCompiler made. Each compiler
+//  keeps its target machines between compiles, so a thread should make one
+//  and reuse it. A compiler is not thread safe, but separate compilers may
+//  be used on separate threads at once.
+//
+//  Errors in the source are still assertions, as they are in the
+//  executable, so only source which is known to be valid should be compiled
+//  in process.
+//
+
+#ifndef __cppl__cppl__
+#define __cppl__cppl__
+
+#include "options.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+struct CompilerContext;
+
+struct CpplOptions {
+    unsigned optLevel = 0;
+    EmitKind emit = EMIT_OBJ;
+    // 2 for -g, 1 for -gline-tables-only
+    unsigned debugInfo = 0;
+    // -fspecialize (1) and -fno-specialize (0), or -1 for the default at optLevel
+    int specialize = -1;
+    // What the debug info and diagnostics call the source
+    std::string sourceName = "<input>";
+    // Receives each diagnostic, a line at a time. Diagnostics are written to
+    // stderr if this isn't set.
+    std::function<void(const std::string &line)> diagnostic;
+};
+
+struct CpplCompiler {
+    std::unique_ptr<CompilerContext> cc;
+
+    CpplCompiler();
+    ~CpplCompiler();
+
+    // Compile source into out, replacing what it held. Returns false, having
+    // reported why through options.diagnostic, on failure.
+    bool compile(const std::string &source, const CpplOptions &options, std::string &out);
+};
+
+#endif /* defined(__cppl__cppl__) */
@@ -0,0 +1,96 @@
+#include "debuginfo.h"
+#include "prgm.h"
+
+#include <unistd.h>
+
+#include <llvm/Support/Dwarf.h>
+
+DebugInfo::DebugInfo(Program &prgm, const std::string &path, DebugLevel level)
+    : prgm(prgm), builder(*prgm.module), full(level == DEBUG_FULL) {
+    auto slash = path.find_last_of('/');
+    auto name = slash == std::string::npos ? path : path.substr(slash + 1);
+    auto dir = slash == std::string::npos ? std::string() : path.substr(0, slash);
+
+    // Debuggers and profilers find the source by its absolute directory
+    if (dir.empty() || dir[0] != '/') {
+        char cwd[4096];
+        if (getcwd(cwd, sizeof(cwd)) != NULL) {
+            dir = dir.empty() ? cwd : std::string(cwd) + "/" + dir;
+        }
+    }
+
+    unit = builder.createCompileUnit(llvm::dwarf::DW_LANG_C, name, dir, "cppl", false, "", 0, "",
+                                     full ? llvm::DIBuilder::FullDebug : llvm::DIBuilder::LineTablesOnly);
+    file = builder.createFile(name, dir);
+
+    prgm.module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    prgm.module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+}
+
+void DebugInfo::beginFunction(llvm::Function *fn, FunctionProto &proto) {
+    // Line tables only need to know that the function exists
+    std::vector<llvm::Metadata *> signature;
+    if (full) {
+        signature.push_back(typeOf(proto.returnType));
+        for (auto &arg : proto.arguments) {
+            signature.push_back(typeOf(arg.type));
+        }
+    }
+    auto type = builder.createSubroutineType(file, builder.getOrCreateTypeArray(signature));
+
+    current = builder.createFunction(unit, proto.name.data, fn->getName(), file, proto.loc.line, type,
+                                     fn->hasInternalLinkage(), true, proto.loc.line, 0, false, fn);
+    setLocation(proto.loc);
+}
+
+void DebugInfo::setLocation(SourceLoc loc) {
+    if (loc.line == 0) return;
+
+    prgm.builder.SetCurrentDebugLocation(llvm::DebugLoc::get(loc.line, loc.col, current));
+}
+
+void DebugInfo::declare(llvm::Value *storage, istr name, Type &type, SourceLoc loc, unsigned argNo) {
+    if (! full) return;
+
+    auto tag = argNo != 0 ? llvm::dwarf::DW_TAG_arg_variable : llvm::dwarf::DW_TAG_auto_variable;
+    auto var = builder.createLocalVariable(tag, current, name.data, file, loc.line, typeOf(type), true, 0, argNo);
+    auto declare = builder.insertDeclare(storage, var, builder.createExpression(), prgm.builder.GetInsertBlock());
+    declare->setDebugLoc(llvm::DebugLoc::get(loc.line, loc.col, current));
+}
+
+void DebugInfo::finalize() {
+    builder.finalize();
+}
+
+llvm::DIType DebugInfo::typeOf(Type &type) {
+    auto found = types.find(type.ident);
+    if (found != types.end()) return found->second;
+
+    std::string name = type.ident.data;
+    llvm::DIType result;
+    if (name == "i8" || name == "i16" || name == "i32" || name == "i64") {
+        auto bits = std::stoul(name.substr(1));
+        result = builder.createBasicType(name, bits, bits, llvm::dwarf::DW_ATE_signed);
+    } else if (name == "f16" || name == "f32" || name == "f64") {
+        auto bits = std::stoul(name.substr(1));
+        result = builder.createBasicType(name, bits, bits, llvm::dwarf::DW_ATE_float);
+    } else if (name == "boolean") {
+        result = builder.createBasicType(name, 8, 8, llvm::dwarf::DW_ATE_boolean);
+    } else if (name == "string") {
+        // The layout of Builtin::string
+        auto width = prgm.pointerWidth;
+        auto chr = builder.createBasicType("char", 8, 8, llvm::dwarf::DW_ATE_signed_char);
+        auto length = builder.createBasicType("usize", width, width, llvm::dwarf::DW_ATE_unsigned);
+        std::vector<llvm::Metadata *> members = {
+            builder.createMemberType(unit, "data", file, 0, width, width, 0, 0,
+                                     builder.createPointerType(chr, width)),
+            builder.createMemberType(unit, "length", file, 0, width, width, width, 0, length)
+        };
+        result = builder.createStructType(unit, name, file, 0, 2 * width, width, 0, llvm::DIType(),
+                                          builder.getOrCreateArray(members));
+    }
+    // Anything else (void, and structs until they are implemented) has no type
+
+    types.emplace(type.ident, result);
+    return result;
+}
@@ -0,0 +1,57 @@
+//
+//  debuginfo.h
+//  cppl
+//
+//  DWARF debug info for -g and -gline-tables-only, built with DIBuilder
+//  from the source positions the lexer records in the AST.
+//
+
+#ifndef __cppl__debuginfo__
+#define __cppl__debuginfo__
+
+#include "ast.h"
+
+#include <string>
+#include <unordered_map>
+
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/Function.h>
+
+struct Program;
+
+enum DebugLevel {
+    DEBUG_NONE,
+    DEBUG_LINE_TABLES, // -gline-tables-only: functions and lines, nothing else
+    DEBUG_FULL         // -g: types and variables too
+};
+
+struct DebugInfo {
+    Program &prgm;
+    llvm::DIBuilder builder;
+    bool full;
+
+    llvm::DICompileUnit unit;
+    llvm::DIFile file;
+    llvm::DISubprogram current; // The function being generated
+
+    std::unordered_map<istr, llvm::DIType> types;
+
+    DebugInfo(Program &prgm, const std::string &path, DebugLevel level);
+
+    // Describe fn, and make it the scope of the locations that follow
+    void beginFunction(llvm::Function *fn, FunctionProto &proto);
+
+    // Attribute the instructions generated from here on to loc
+    void setLocation(SourceLoc loc);
+
+    // Describe a variable (or argument, when argNo is not 0) kept in storage
+    void declare(llvm::Value *storage, istr name, Type &type, SourceLoc loc, unsigned argNo);
+
+    void finalize();
+
+private:
+    llvm::DIType typeOf(Type &type);
+};
+
+#endif /* defined(__cppl__debuginfo__) */
@@ -0,0 +1,681 @@
+#include "driver.h"
+#include "cache.h"
+#include "incremental.h"
+#include "lexer.h"
+#include "parse.h"
+#include "prgm.h"
+#include "profile.h"
+#include "remarks.h"
+#include "specialize.h"
+#include "split.h"
+#include "stats.h"
+#include "stream.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Pass.h>
+#include <llvm/PassManager.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormattedStream.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetLibraryInfo.h>
+#include <llvm/Target/TargetSubtargetInfo.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+void initializeLLVM() {
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+
+        llvm::PassRegistry *registry = llvm::PassRegistry::getPassRegistry();
+        llvm::initializeCore(*registry);
+        llvm::initializeCodeGen(*registry);
+        llvm::initializeLoopStrengthReducePass(*registry);
+        llvm::initializeLowerIntrinsicsPass(*registry);
+        llvm::initializeUnreachableBlockElimPass(*registry);
+    });
+}
+
+std::unique_ptr<llvm::Module> compileSource(llvm::LLVMContext &context, std::istream *input,
+                                            const CodegenOptions &options, std::ostream &diag) {
+    // Parse it!
+    auto lex = Lexer(input);
+    std::vector<std::unique_ptr<Item>> stmts;
+    {
+        TimeScope scope("parse");
+        StatsPhase phase("parse");
+        stmts = parse(&lex);
+    }
+    if (options.specialize) {
+        TimeScope scope("specialize");
+        StatsPhase phase("specialize");
+        specializeFunctions(stmts);
+    }
+
+    Program prgm(context);
+    prgm.options = options;
+    prgm.diag = &diag;
+    {
+        TimeScope scope("addItems");
+        StatsPhase phase("addItems");
+        prgm.addItems(stmts);
+    }
+    {
+        TimeScope scope("finalize");
+        StatsPhase phase("finalize");
+        prgm.finalize();
+    }
+
+    // The Program never frees its module, so we can take ownership of it here
+    return std::unique_ptr<llvm::Module>(prgm.module);
+}
+
+static bool endsWith(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() &&
+        str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool codegenOptions(const Options &opts, CodegenOptions &options, std::ostream &diag) {
+    options.profileGenerate = opts.profileGenerate;
+    options.debugInfo = (DebugLevel) opts.debugInfo;
+    options.instrument = opts.instrument;
+    options.specialize = wantsSpecialize(opts);
+
+    if (! opts.profileUse.empty()) {
+        auto profile = std::make_shared<ProfileData>();
+        std::string error;
+        if (! profile->load(opts.profileUse, error)) {
+            diag << "cppl: " << error << "\n";
+            return false;
+        }
+        options.profile = profile;
+    }
+
+    if (! opts.symbolOrderingFile.empty()) {
+        std::ifstream file(opts.symbolOrderingFile);
+        if (! file) {
+            diag << "cppl: could not open " << opts.symbolOrderingFile << "\n";
+            return false;
+        }
+        // One symbol per line, as for lld; # starts a comment
+        auto order = std::make_shared<std::vector<std::string>>();
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, line.find('#'));
+            auto begin = line.find_first_not_of(" \t");
+            if (begin == std::string::npos) continue;
+            order->push_back(line.substr(begin, line.find_last_not_of(" \t") + 1 - begin));
+        }
+        options.symbolOrder = order;
+    }
+    return true;
+}
+
+// Move the functions named by the symbol ordering file to the front of the
+// module, in order, so that the object is laid out that way even if the
+// linker doesn't order sections
+static void orderFunctions(llvm::Module &mod, const std::vector<std::string> &order) {
+    auto &functions = mod.getFunctionList();
+    for (auto name = order.rbegin(); name != order.rend(); ++name) {
+        auto fn = mod.getFunction(*name);
+        if (fn == NULL || fn->isDeclaration()) continue;
+        functions.splice(functions.begin(), functions, fn);
+    }
+}
+
+std::unique_ptr<llvm::Module> loadInput(llvm::LLVMContext &context, const std::string &path,
+                                        const CodegenOptions &options, std::ostream &diag) {
+    TimeScope scope("load", path);
+    if (endsWith(path, ".cppl")) {
+        std::ifstream fileStream;
+        fileStream.open(path);
+        if (! fileStream) {
+            diag << "cppl: could not open " << path << "\n";
+            return nullptr;
+        }
+
+        auto fileOptions = options;
+        fileOptions.sourcePath = path;
+        auto mod = compileSource(context, &fileStream, fileOptions, diag);
+        mod->setModuleIdentifier(path);
+        return mod;
+    }
+
+    llvm::SMDiagnostic err;
+    auto mod = llvm::parseIRFile(path, err, context);
+    if (! mod) {
+        std::string msg;
+        llvm::raw_string_ostream os(msg);
+        err.print("cppl", os);
+        diag << os.str();
+    }
+    return mod;
+}
+
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(llvm::Module &mod, unsigned optLevel, std::string &error) {
+    llvm::Triple targetTriple(mod.getTargetTriple());
+    if (targetTriple.getTriple().empty()) {
+        targetTriple.setTriple(llvm::sys::getDefaultTargetTriple());
+    }
+
+    const llvm::Target *target = llvm::TargetRegistry::lookupTarget("", targetTriple, error);
+    if (! target) {
+        return nullptr;
+    }
+
+    auto cgOptLvl = llvm::CodeGenOpt::Default;
+    switch (optLevel) {
+    case 0: cgOptLvl = llvm::CodeGenOpt::None; break;
+    case 1: cgOptLvl = llvm::CodeGenOpt::Less; break;
+    case 2: cgOptLvl = llvm::CodeGenOpt::Default; break;
+    default: cgOptLvl = llvm::CodeGenOpt::Aggressive; break;
+    }
+
+    // llvm::TargetOptions options;
+    // TODO: llc line 268
+
+    std::unique_ptr<llvm::TargetMachine> targetMachine(target->createTargetMachine(targetTriple.getTriple(),
+                                                                                   llvm::sys::getHostCPUName(),
+                                                                                   "",
+                                                                                   llvm::TargetOptions(),
+                                                                                   llvm::Reloc::Default,
+                                                                                   llvm::CodeModel::Default,
+                                                                                   cgOptLvl));
+    assert(targetMachine && "Could not allocate target machine!");
+
+    configureModule(mod, *targetMachine);
+    return targetMachine;
+}
+
+void configureModule(llvm::Module &mod, llvm::TargetMachine &targetMachine) {
+    mod.setTargetTriple(targetMachine.getTargetTriple());
+    if (const llvm::DataLayout *datalayout = targetMachine.getSubtargetImpl()->getDataLayout())
+        mod.setDataLayout(datalayout);
+}
+
+static void addTargetPasses(llvm::PassManagerBase &pm, llvm::Module &mod, llvm::TargetMachine &targetMachine) {
+    pm.add(new llvm::TargetLibraryInfo(llvm::Triple(mod.getTargetTriple())));
+    pm.add(new llvm::DataLayoutPass());
+    targetMachine.addAnalysisPasses(pm);
+}
+
+void optimizeModule(llvm::Module &mod, llvm::TargetMachine &targetMachine, unsigned optLevel) {
+    recordIRStats(mod, "generated");
+    if (optLevel == 0) return;
+
+    TimeScope scope("optimize");
+    StatsPhase phase("optimize");
+
+    llvm::PassManagerBuilder builder;
+    builder.OptLevel = optLevel;
+    if (optLevel > 1) {
+        builder.Inliner = llvm::createFunctionInliningPass(optLevel, 0);
+    } else {
+        builder.Inliner = llvm::createAlwaysInlinerPass();
+    }
+
+    llvm::FunctionPassManager fpm(&mod);
+    fpm.add(new llvm::DataLayoutPass());
+    targetMachine.addAnalysisPasses(fpm);
+    builder.populateFunctionPassManager(fpm);
+
+    fpm.doInitialization();
+    for (auto &fn : mod) {
+        fpm.run(fn);
+    }
+    fpm.doFinalization();
+
+    llvm::PassManager mpm;
+    addTargetPasses(mpm, mod, targetMachine);
+    builder.populateModulePassManager(mpm);
+    mpm.run(mod);
+
+    recordIRStats(mod, "optimized");
+}
+
+// Added before and after the codegen passes to time the backend for each
+// function. The codegen passes are all function passes, so they are run
+// one function at a time between the two.
+struct BackendTimerPass : public llvm::FunctionPass {
+    static char ID;
+    TimePoint *start;
+    bool begin;
+
+    BackendTimerPass(TimePoint *start, bool begin) : llvm::FunctionPass(ID), start(start), begin(begin) {}
+
+    const char *getPassName() const override {
+        return begin ? "cppl backend timer start" : "cppl backend timer end";
+    }
+
+    void getAnalysisUsage(llvm::AnalysisUsage &au) const override {
+        au.setPreservesAll();
+    }
+
+    bool runOnFunction(llvm::Function &fn) override {
+        if (begin) {
+            *start = std::chrono::steady_clock::now();
+        } else {
+            recordSpan("backend-function", fn.getName().str(), *start);
+        }
+        return false;
+    }
+};
+char BackendTimerPass::ID = 0;
+
+bool emitFile(llvm::Module &mod, llvm::TargetMachine &targetMachine,
+              llvm::raw_ostream &os, llvm::TargetMachine::CodeGenFileType fileType) {
+    llvm::PassManager passmanager;
+    passmanager.add(new llvm::TargetLibraryInfo(llvm::Triple(mod.getTargetTriple())));
+
+    TimePoint fnStart;
+    if (timingEnabled) passmanager.add(new BackendTimerPass(&fnStart, true));
+
+    llvm::formatted_raw_ostream ostream(os);
+
+    // Ask the target to add backend passes as necessary.
+    if (targetMachine.addPassesToEmitFile(passmanager, ostream, fileType)) {
+        return true;
+    }
+
+    if (timingEnabled) passmanager.add(new BackendTimerPass(&fnStart, false));
+
+    TimeScope scope("backend", mod.getModuleIdentifier());
+    StatsPhase phase("backend");
+    passmanager.run(mod);
+    return false;
+}
+
+void emitBitcode(llvm::Module &mod, llvm::raw_ostream &os) {
+    TimeScope scope("emit-bitcode");
+    StatsPhase phase("emit-bitcode");
+    llvm::WriteBitcodeToFile(&mod, os);
+}
+
+std::unique_ptr<llvm::Module> linkModules(std::vector<std::unique_ptr<llvm::Module>> modules, std::string &error) {
+    assert(! modules.empty());
+    TimeScope scope("link");
+    StatsPhase phase("link");
+
+    std::unique_ptr<llvm::Module> composite = std::move(modules[0]);
+    llvm::Linker linker(composite.get());
+    for (size_t i=1; i<modules.size(); i++) {
+        if (linker.linkInModule(modules[i].get())) {
+            error = "could not link module " + modules[i]->getModuleIdentifier();
+            return nullptr;
+        }
+    }
+
+    return composite;
+}
+
+void optimizeLinkedModule(llvm::Module &mod, llvm::TargetMachine &targetMachine,
+                          unsigned optLevel, const std::vector<const char *> &exports) {
+    recordIRStats(mod, "generated");
+    TimeScope scope("optimize-lto");
+    StatsPhase phase("optimize-lto");
+
+    llvm::PassManager pm;
+    addTargetPasses(pm, mod, targetMachine);
+
+    // Everything which isn't visible from outside of the program can be
+    // freely inlined, specialized, or deleted
+    pm.add(llvm::createInternalizePass(exports));
+
+    if (optLevel > 0) {
+        llvm::PassManagerBuilder builder;
+        builder.OptLevel = optLevel;
+        builder.populateLTOPassManager(pm);
+    } else {
+        pm.add(llvm::createGlobalDCEPass());
+    }
+
+    pm.run(mod);
+    recordIRStats(mod, "optimized");
+}
+
+llvm::TargetMachine *CompilerContext::targetMachine(llvm::Module &mod, unsigned optLevel, std::string &error) {
+    auto key = mod.getTargetTriple() + "/" + std::to_string(optLevel);
+
+    auto found = targetMachines.find(key);
+    if (found != targetMachines.end()) {
+        configureModule(mod, *found->second);
+        return found->second.get();
+    }
+
+    auto targetMachine = createTargetMachine(mod, optLevel, error);
+    if (! targetMachine) return NULL;
+
+    auto p = targetMachine.get();
+    targetMachines.emplace(key, std::move(targetMachine));
+    return p;
+}
+
+// Write data to path by way of a temporary file in the same directory, so
+// that a failed or interrupted compile never leaves a partial output behind
+static bool writeAtomically(const std::string &path, llvm::StringRef data, std::string &error) {
+    if (path == "-") {
+        llvm::outs() << data;
+        llvm::outs().flush();
+        return true;
+    }
+
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) {
+        error = "could not write " + path + ": " + strerror(errno);
+        return false;
+    }
+    fchmod(fd, newFileMode());
+
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        auto written = write(fd, p, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        p += written;
+        left -= written;
+    }
+
+    if (close(fd) != 0 || left > 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+        error = "could not write " + path + ": " + strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Produce one --emit output of the module into buffer. Returns false and
+// sets error on failure.
+static bool emitOutput(llvm::Module &mod, llvm::TargetMachine &targetMachine, const Options &opts,
+                       EmitKind kind, llvm::SmallVectorImpl<char> &buffer, std::string &error) {
+    if (kind == EMIT_OBJ && opts.codegenThreads > 1) {
+        return emitObjectParallel(mod, opts.optLevel, opts.codegenThreads, buffer, error);
+    }
+
+    llvm::raw_svector_ostream os(buffer);
+    switch (kind) {
+    case EMIT_LLVM_IR: {
+        TimeScope scope("emit-ir");
+        mod.print(os, nullptr);
+        break;
+    }
+    case EMIT_BC:
+        emitBitcode(mod, os);
+        break;
+    case EMIT_OBJ:
+    case EMIT_ASM:
+        auto fileType = kind == EMIT_OBJ ? llvm::TargetMachine::CGFT_ObjectFile : llvm::TargetMachine::CGFT_AssemblyFile;
+        if (emitFile(mod, targetMachine, os, fileType)) {
+            error = "target does not support generation of this file type!";
+            return false;
+        }
+        break;
+    }
+    os.flush();
+    return true;
+}
+
+// Optimize the module of a compile, leaving it ready for the backend.
+// Returns its TargetMachine, or NULL having written to diag on failure.
+static llvm::TargetMachine *prepareModule(CompilerContext &cc, const Options &opts, const CodegenOptions &options,
+                                          llvm::Module &mod, bool stripLines, std::ostream &diag) {
+    std::string error;
+    auto targetMachine = cc.targetMachine(mod, opts.optLevel, error);
+    if (! targetMachine) {
+        diag << "cppl: " << error << "\n";
+        return NULL;
+    }
+
+    if (opts.lto) {
+        // Only main is visible to the outside world once the program is linked
+        optimizeLinkedModule(mod, *targetMachine, opts.optLevel, { "main" });
+    } else {
+        optimizeModule(mod, *targetMachine, opts.optLevel);
+    }
+    if (stripLines) llvm::StripDebugInfo(mod);
+    if (options.symbolOrder) orderFunctions(mod, *options.symbolOrder);
+    return targetMachine;
+}
+
+bool compileBuffer(CompilerContext &cc, const Options &opts, const std::string &source, const std::string &name,
+                   EmitKind kind, llvm::SmallVectorImpl<char> &buffer, std::ostream &diag) {
+    initializeLLVM();
+
+    CodegenOptions options;
+    if (! codegenOptions(opts, options, diag)) return false;
+    options.sourcePath = name;
+
+    llvm::LLVMContext context;
+    std::istringstream input(source);
+    auto mod = compileSource(context, &input, options, diag);
+    mod->setModuleIdentifier(name);
+
+    auto targetMachine = prepareModule(cc, opts, options, *mod, false, diag);
+    if (! targetMachine) return false;
+
+    std::string error;
+    if (! emitOutput(*mod, *targetMachine, opts, kind, buffer, error)) {
+        diag << "cppl: " << error << "\n";
+        return false;
+    }
+    return true;
+}
+
+static int compileJob(CompilerContext &cc, const Options &opts, std::ostream &diag) {
+    initializeLLVM();
+
+    if (! opts.incrementalDir.empty() || opts.stream) {
+        llvm::SmallVector<char, 0> buffer;
+        std::string error;
+        bool ok = opts.stream ? compileStreaming(cc, opts, buffer, diag) : compileIncremental(cc, opts, buffer, diag);
+        if (! ok) return 1;
+        if (! writeAtomically(emitOutputs(opts)[0].path, llvm::StringRef(buffer.data(), buffer.size()), error)) {
+            diag << "cppl: " << error << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    CodegenOptions options;
+    if (! codegenOptions(opts, options, diag)) return 1;
+
+    // Remarks are located by line tables, which are only kept if asked for
+    bool stripLines = wantsRemarks(opts) && options.debugInfo == DEBUG_NONE;
+    if (stripLines) options.debugInfo = DEBUG_LINE_TABLES;
+
+    llvm::LLVMContext context;
+    RemarkCollector remarks(opts, diag);
+    if (wantsRemarks(opts)) {
+        if (! remarks.init()) return 1;
+        remarks.install(context);
+    }
+
+    std::vector<std::unique_ptr<llvm::Module>> modules;
+    for (auto &input : opts.inputs) {
+        auto mod = loadInput(context, input, options, diag);
+        if (! mod) return 1;
+        modules.push_back(std::move(mod));
+    }
+
+    std::unique_ptr<llvm::Module> mod;
+    if (opts.lto) {
+        std::string error;
+        mod = linkModules(std::move(modules), error);
+        if (! mod) {
+            diag << "cppl: " << error << "\n";
+            return 1;
+        }
+    } else {
+        mod = std::move(modules[0]);
+    }
+
+    /* DEBUG */
+    // mod->dump();
+
+    auto targetMachine = prepareModule(cc, opts, options, *mod, stripLines, diag);
+    if (! targetMachine) return 1;
+
+    // IR and bitcode are written first, as they leave the module alone. The
+    // backend changes the module as it lowers it, so every backend output
+    // but the last is made from a copy.
+    auto outputs = emitOutputs(opts);
+    std::stable_partition(outputs.begin(), outputs.end(), [](const EmitOutput &output) {
+        return output.kind == EMIT_LLVM_IR || output.kind == EMIT_BC;
+    });
+
+    std::string error;
+    for (size_t i=0; i<outputs.size(); i++) {
+        auto &output = outputs[i];
+        bool backend = output.kind == EMIT_OBJ || output.kind == EMIT_ASM;
+
+        std::unique_ptr<llvm::Module> copy;
+        if (backend && i + 1 < outputs.size()) {
+            TimeScope scope("clone-module");
+            copy.reset(llvm::CloneModule(mod.get()));
+        }
+
+        llvm::SmallVector<char, 0> buffer;
+        if (! emitOutput(copy ? *copy : *mod, *targetMachine, opts, output.kind, buffer, error) ||
+            ! writeAtomically(output.path, llvm::StringRef(buffer.data(), buffer.size()), error)) {
+            diag << "cppl: " << error << "\n";
+            return 1;
+        }
+    }
+
+    if (wantsRemarks(opts) && ! remarks.finish(error)) {
+        diag << "cppl: " << error << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+void beginReports(const Options &opts, bool llvmPasses) {
+    if (opts.timeReport || ! opts.tracePath.empty()) {
+        enableTiming(opts.timeReport && llvmPasses);
+    }
+    if (! opts.statsPath.empty()) {
+        enableStats();
+    }
+}
+
+bool writeReports(const Options &opts, std::ostream &diag) {
+    if (opts.timeReport) {
+        writeTimeReport(diag);
+    }
+    if (! opts.tracePath.empty() && ! writeTrace(opts.tracePath)) {
+        diag << "cppl: could not write " << opts.tracePath << "\n";
+        return false;
+    }
+    if (opts.statsPath == "-") {
+        writeStats(diag);
+    } else if (! opts.statsPath.empty()) {
+        std::ofstream os(opts.statsPath);
+        if (! writeStats(os)) {
+            diag << "cppl: could not write " << opts.statsPath << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int runJob(CompilerContext &cc, const Options &opts, std::ostream &diag) {
+    if (opts.outputIsDir) {
+        return runBatch(opts, diag);
+    }
+
+    // Remarks only come from actually compiling
+    if (opts.cacheDir.empty() || wantsRemarks(opts)) {
+        return compileJob(cc, opts, diag);
+    }
+
+    // Each output is its own cache entry, and it's only a hit if all of them are
+    ObjectCache cache(opts.cacheDir, opts.cacheSize);
+    auto key = cache.key(opts);
+    auto outputs = emitOutputs(opts);
+    if (! key.empty()) {
+        bool hit = true;
+        for (auto &output : outputs) {
+            if (! cache.fetch(key + "." + emitExtension(output.kind), output.path)) {
+                hit = false;
+                break;
+            }
+        }
+        if (hit) return 0;
+    }
+
+    int status = compileJob(cc, opts, diag);
+    if (status == 0 && ! key.empty()) {
+        for (auto &output : outputs) {
+            cache.store(key + "." + emitExtension(output.kind), output.path);
+        }
+    }
+    return status;
+}
+
+int runBatch(const Options &opts, std::ostream &diag) {
+    initializeLLVM();
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> status(0);
+    std::mutex diagLock;
+
+    // Each worker has its own CompilerContext, and every job gets its own
+    // LLVMContext and Program, so the workers share nothing but the intern pool
+    auto worker = [&]() {
+        CompilerContext cc;
+        for (;;) {
+            size_t i = next++;
+            if (i >= opts.inputs.size()) return;
+
+            Options job = opts;
+            job.outputIsDir = false;
+            job.inputs = { opts.inputs[i] };
+            job.output = batchOutput(opts, opts.inputs[i]);
+
+            std::ostringstream jobDiag;
+            if (runJob(cc, job, jobDiag) != 0) {
+                status = 1;
+            }
+
+            std::lock_guard<std::mutex> guard(diagLock);
+            diag << jobDiag.str();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i=1; i<opts.jobs && i<opts.inputs.size(); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    return status;
+}
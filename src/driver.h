@@ -0,0 +1,106 @@
+//
+//  driver.h
+//  cppl
+//
+//  Shared pieces of the compiler driver: LLVM setup, the front-end entry
+//  point, the optimizer pipeline and output emission.
+//
+
+#ifndef __cppl__driver__
+#define __cppl__driver__
+
+#include "options.h"
+#include "prgm.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+// Initialize the native target and the pass registry. This only does
+// work the first time it is called.
+void initializeLLVM();
+
+// Lex, parse and generate IR for the cppl source read from input, writing
+// any warnings to diag
+std::unique_ptr<llvm::Module> compileSource(llvm::LLVMContext &context, std::istream *input,
+                                            const CodegenOptions &options = CodegenOptions(),
+                                            std::ostream &diag = std::cerr);
+
+// The code generation settings of a command line. Returns false and writes
+// to diag if they can't be set up, such as when the profile can't be read.
+bool codegenOptions(const Options &opts, CodegenOptions &options, std::ostream &diag);
+
+// Load an input as a module. cppl sources go through the front-end, anything
+// else is expected to be LLVM bitcode or textual IR. Returns NULL and writes
+// to diag on failure.
+std::unique_ptr<llvm::Module> loadInput(llvm::LLVMContext &context, const std::string &path,
+                                        const CodegenOptions &options, std::ostream &diag);
+
+// Create a TargetMachine for the triple of the module (or the host if
+// the module has none). Returns NULL and sets error on failure.
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(llvm::Module &mod, unsigned optLevel, std::string &error);
+
+// Give the module the triple and data layout of the target machine
+void configureModule(llvm::Module &mod, llvm::TargetMachine &targetMachine);
+
+// Run the IR optimizer over the module at the given -O level
+void optimizeModule(llvm::Module &mod, llvm::TargetMachine &targetMachine, unsigned optLevel);
+
+// Ask the target to lower the module into os. Returns true on error.
+bool emitFile(llvm::Module &mod, llvm::TargetMachine &targetMachine,
+              llvm::raw_ostream &os, llvm::TargetMachine::CodeGenFileType fileType);
+
+// Write the module as LLVM bitcode
+void emitBitcode(llvm::Module &mod, llvm::raw_ostream &os);
+
+// Link every module into the first one. Returns NULL and sets error on failure.
+std::unique_ptr<llvm::Module> linkModules(std::vector<std::unique_ptr<llvm::Module>> modules, std::string &error);
+
+// Give every definition not named in exports internal linkage, and run the
+// whole-program optimizer over the result
+void optimizeLinkedModule(llvm::Module &mod, llvm::TargetMachine &targetMachine,
+                          unsigned optLevel, const std::vector<const char *> &exports);
+
+// State which is expensive to set up, and which a thread can reuse
+// between compiles. Not thread safe.
+struct CompilerContext {
+    std::unordered_map<std::string, std::unique_ptr<llvm::TargetMachine>> targetMachines;
+
+    // A TargetMachine for the module at optLevel, created on first use
+    llvm::TargetMachine *targetMachine(llvm::Module &mod, unsigned optLevel, std::string &error);
+};
+
+// Compile the cppl source held in source into buffer, as a single output of
+// kind, without touching the filesystem. name is what the debug info and
+// the module call the source. Only the code generation and -O settings of
+// opts are used. Returns false and writes to diag on failure.
+bool compileBuffer(CompilerContext &cc, const Options &opts, const std::string &source, const std::string &name,
+                   EmitKind kind, llvm::SmallVectorImpl<char> &buffer, std::ostream &diag);
+
+// Start recording what opts asks for a report of (-ftime-report, --trace
+// and --stats). LLVM only times its passes if llvmPasses is set, as it reports
+// them itself when it is shut down.
+void beginReports(const Options &opts, bool llvmPasses);
+
+// Write the reports opts asks for, the time report and --stats=- to diag.
+// Returns false
+// and writes to diag if one can't be written.
+bool writeReports(const Options &opts, std::ostream &diag);
+
+// Run a MODE_COMPILE job, writing diagnostics to diag. Returns the exit status.
+int runJob(CompilerContext &cc, const Options &opts, std::ostream &diag);
+
+// Compile each input of opts into its own file in the output directory,
+// using opts.jobs threads. Returns the exit status.
+int runBatch(const Options &opts, std::ostream &diag);
+
+#endif /* defined(__cppl__driver__) */
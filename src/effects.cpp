@@ -0,0 +1,219 @@
+#include "effects.h"
+
+#include <unordered_set>
+
+// The calls made by a function body. Calls to anything other than a
+// function named directly (including names shadowed by locals) are unknown.
+class CallCollector : public ExprVisitor, public StmtVisitor {
+public:
+    std::vector<istr> callees;
+    std::vector<istr> alwaysCalled; // Callees outside of any if
+    std::vector<istr> referenced; // Names used other than as a callee
+    std::unordered_set<istr> locals;
+    bool unknownCall = false;
+    unsigned branchDepth = 0;
+
+    void body(std::vector<std::unique_ptr<Stmt>> &stmts) {
+        for (auto &stmt : stmts) {
+            stmt->accept(*this);
+        }
+    }
+
+    void args(std::vector<std::unique_ptr<Expr>> &exprs) {
+        for (auto &expr : exprs) {
+            expr->accept(*this);
+        }
+    }
+
+    virtual void visit(StringExpr *) {}
+    virtual void visit(IntExpr *) {}
+    virtual void visit(BoolExpr *) {}
+    virtual void visit(MkExpr *expr) {
+        args(expr->fields);
+    }
+    virtual void visit(CallExpr *expr) {
+        if (auto ident = dynamic_cast<IdentExpr *>(expr->callee.get())) {
+            callees.push_back(ident->ident);
+            if (branchDepth == 0) alwaysCalled.push_back(ident->ident);
+        } else {
+            unknownCall = true;
+            expr->callee->accept(*this);
+        }
+        args(expr->args);
+    }
+    virtual void visit(MthdCallExpr *expr) {
+        unknownCall = true;
+        expr->object->accept(*this);
+        args(expr->args);
+    }
+    virtual void visit(MemberExpr *expr) {
+        expr->object->accept(*this);
+    }
+    virtual void visit(IdentExpr *expr) {
+        referenced.push_back(expr->ident);
+    }
+    virtual void visit(InfixExpr *expr) {
+        expr->lhs->accept(*this);
+        expr->rhs->accept(*this);
+    }
+    virtual void visit(IfExpr *expr) {
+        branchDepth++;
+        for (auto &branch : expr->branches) {
+            if (branch.cond != NULL) branch.cond->accept(*this);
+            body(branch.body);
+        }
+        branchDepth--;
+    }
+
+    virtual void visit(DeclarationStmt *stmt) {
+        // Every declaration is in scope for the whole function
+        locals.insert(stmt->name);
+        stmt->value->accept(*this);
+    }
+    virtual void visit(ExprStmt *stmt) {
+        stmt->expr->accept(*this);
+    }
+    virtual void visit(ReturnStmt *stmt) {
+        if (stmt->value != nullptr) stmt->value->accept(*this);
+    }
+    virtual void visit(EmptyStmt *) {}
+};
+
+// The calls made by, and names referenced by, the body of a function
+static CallCollector collectCalls(FunctionItem *item) {
+    CallCollector calls;
+    for (auto &arg : item->proto.arguments) {
+        calls.locals.insert(arg.name);
+    }
+    calls.body(item->body);
+    return calls;
+}
+
+void EffectsSummary::add(Item &item) {
+    if (auto ffiItem = dynamic_cast<FFIFunctionItem *>(&item)) {
+        FunctionEffects &ffi = effects[ffiItem->proto.name];
+        ffi.cold = ffiItem->cold;
+        if (ffiItem->purity != PURITY_NONE) {
+            ffi.memory = ffiItem->purity == PURITY_CONST ? MEMORY_NONE : MEMORY_READ;
+            ffi.mayUnwind = false;
+        }
+    } else if (auto fnItem = dynamic_cast<FunctionItem *>(&item)) {
+        auto calls = collectCalls(fnItem);
+
+        // Start from the best case, and let the calls make it worse
+        FunctionEffects &fn = effects[fnItem->proto.name];
+        fn.memory = bodiesWrite ? MEMORY_WRITE : MEMORY_NONE;
+        fn.mayUnwind = false;
+        fn.cold = fnItem->cold;
+
+        Body body = { fnItem->proto.name, {}, {}, calls.unknownCall };
+        for (auto &callee : calls.callees) {
+            if (calls.locals.count(callee) != 0) {
+                body.unknownCall = true;
+            } else {
+                body.callees.push_back(callee);
+            }
+        }
+        for (auto &callee : calls.alwaysCalled) {
+            if (calls.locals.count(callee) == 0) body.alwaysCalled.push_back(callee);
+        }
+        bodies.push_back(std::move(body));
+
+        for (auto &name : calls.referenced) {
+            if (calls.locals.count(name) == 0) addressTaken.insert(name);
+        }
+    }
+}
+
+std::unordered_map<istr, FunctionEffects> EffectsSummary::solve() {
+    auto solved = effects;
+
+    for (auto &body : bodies) {
+        bool unknownCall = body.unknownCall;
+        for (auto &callee : body.callees) {
+            if (solved.count(callee) == 0) unknownCall = true;
+        }
+        if (unknownCall) {
+            auto cold = solved[body.name].cold;
+            solved[body.name] = FunctionEffects();
+            solved[body.name].cold = cold;
+        }
+    }
+
+    // Spread the effects up the call graph until nothing changes. Each
+    // lattice only ever gets worse, so this terminates, and recursive
+    // functions only get the effects of what they call outside the cycle.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto &body : bodies) {
+            auto &fn = solved[body.name];
+            for (auto &callee : body.callees) {
+                auto found = solved.find(callee);
+                if (found == solved.end()) continue;
+
+                if (found->second.memory > fn.memory) {
+                    fn.memory = found->second.memory;
+                    changed = true;
+                }
+                if (found->second.mayUnwind && ! fn.mayUnwind) {
+                    fn.mayUnwind = true;
+                    changed = true;
+                }
+            }
+            for (auto &callee : body.alwaysCalled) {
+                auto found = solved.find(callee);
+                if (found != solved.end() && found->second.cold && ! fn.cold) {
+                    fn.cold = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    return solved;
+}
+
+std::unordered_map<istr, FunctionEffects> inferEffects(std::vector<std::unique_ptr<Item>> &items,
+                                                      bool bodiesWrite) {
+    EffectsSummary summary(bodiesWrite);
+    for (auto &item : items) {
+        summary.add(*item);
+    }
+    return summary.solve();
+}
+
+std::unordered_set<istr> addressTakenFunctions(std::vector<std::unique_ptr<Item>> &items) {
+    EffectsSummary summary(false);
+    for (auto &item : items) {
+        summary.add(*item);
+    }
+    return summary.addressTaken;
+}
+
+std::vector<istr> globalReferences(FunctionItem *item) {
+    auto calls = collectCalls(item);
+    std::vector<istr> names;
+    for (auto list : { &calls.callees, &calls.referenced }) {
+        for (auto &name : *list) {
+            if (calls.locals.count(name) == 0) names.push_back(name);
+        }
+    }
+    return names;
+}
+
+void addEffectAttributes(llvm::Function *fn, const FunctionEffects &effects) {
+    if (effects.memory == MEMORY_NONE) {
+        fn->addFnAttr(llvm::Attribute::ReadNone);
+    } else if (effects.memory == MEMORY_READ) {
+        fn->addFnAttr(llvm::Attribute::ReadOnly);
+    }
+
+    if (! effects.mayUnwind) {
+        fn->addFnAttr(llvm::Attribute::NoUnwind);
+    }
+
+    if (effects.cold) {
+        fn->addFnAttr(llvm::Attribute::Cold);
+    }
+}
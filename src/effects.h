@@ -0,0 +1,79 @@
+//
+//  effects.h
+//  cppl
+//
+//  Inference of what calling each function may do, so that LLVM can be
+//  told which calls it may merge, hoist or delete.
+//
+
+#ifndef __cppl__effects__
+#define __cppl__effects__
+
+#include "ast.h"
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <llvm/IR/Function.h>
+
+enum MemoryEffect {
+    MEMORY_NONE,  // Touches no memory but its own stack (readnone)
+    MEMORY_READ,  // May read memory (readonly)
+    MEMORY_WRITE  // May do anything
+};
+
+struct FunctionEffects {
+    MemoryEffect memory = MEMORY_WRITE;
+    bool mayUnwind = true;
+    // Declared cold, or always calls a cold function, so that any path to
+    // a call of it is unlikely
+    bool cold = false;
+};
+
+// What inference needs to know about a program, gathered one item at a time
+// so that the items can be freed as they are read
+struct EffectsSummary {
+    bool bodiesWrite;
+    // Names used other than as a callee
+    std::unordered_set<istr> addressTaken;
+
+    explicit EffectsSummary(bool bodiesWrite) : bodiesWrite(bodiesWrite) {}
+
+    void add(Item &item);
+
+    // The effects of every function added so far
+    std::unordered_map<istr, FunctionEffects> solve();
+
+private:
+    struct Body {
+        istr name;
+        std::vector<istr> callees;
+        std::vector<istr> alwaysCalled; // Outside of any branch
+        bool unknownCall;
+    };
+
+    std::unordered_map<istr, FunctionEffects> effects;
+    std::vector<Body> bodies;
+};
+
+// Infer the effects of every function declared in items. FFI functions do
+// anything unless they are annotated pure or const, and a cppl function has
+// the effects of everything it calls, plus writes of its own if bodiesWrite
+// (as when instrumented for profiling). A function is cold if it is declared
+// cold, or calls a cold function outside of any branch.
+std::unordered_map<istr, FunctionEffects> inferEffects(std::vector<std::unique_ptr<Item>> &items,
+                                                      bool bodiesWrite);
+
+// The functions in items whose address is taken, by being named anywhere
+// other than as the callee of a call
+std::unordered_set<istr> addressTakenFunctions(std::vector<std::unique_ptr<Item>> &items);
+
+// The names outside of itself which the body of item refers to, called or not
+std::vector<istr> globalReferences(FunctionItem *item);
+
+// Give fn the LLVM attributes matching its effects (including cold)
+void addEffectAttributes(llvm::Function *fn, const FunctionEffects &effects);
+
+#endif /* defined(__cppl__effects__) */
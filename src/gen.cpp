@@ -1,4 +1,6 @@
 #include "gen.h"
+#include "instrument.h"
+#include "profile.h"
 
 #include <llvm/IR/Verifier.h>
 
@@ -49,17 +51,9 @@ public:
         // once we get to that point in terms of compiler construction
         llvm::StructType *stringTy = llvm::cast<llvm::StructType>(prgm.builtin.string->asType()->llType());
 
-        // Allocate the string struct, and fill it with data - This allocal _should_ be optimized
-        // out by the compiler at some point
-        auto stringStruct = prgm.builder.CreateAlloca(stringTy);
-        auto stringDataPtr = prgm.builder.CreateConstInBoundsGEP2_32(stringStruct, 0, 0);
-        auto stringLenPtr = prgm.builder.CreateConstInBoundsGEP2_32(stringStruct, 0, 1);
-
-        prgm.builder.CreateStore(data, stringDataPtr);
-        prgm.builder.CreateStore(length, stringLenPtr);
-
-        // Get it back into value-form
-        thing = prgm.thing<STVThing>(prgm.builder.CreateLoad(stringStruct),
+        // Both fields are constants, so the string is too, and needs no stack slot
+        std::vector<llvm::Constant *> fields = { llvm::cast<llvm::Constant>(data), length };
+        thing = prgm.thing<STVThing>(llvm::ConstantStruct::get(stringTy, fields),
                                         prgm.builtin.string->asType())->asValue();
     }
     virtual void visit(IntExpr *expr) {
@@ -89,7 +83,8 @@ public:
         assert(aThing->asValue());
     }
     virtual void visit(CallExpr *expr) {
-        auto callee = genExpr(prgm, *expr->callee)->asValue()->llValue();
+        auto calleeThing = genExpr(prgm, *expr->callee)->asValue();
+        auto callee = calleeThing->llValue();
 
         // TODO(michael): assert(callee->isCallable());
 
@@ -103,8 +98,12 @@ public:
             args.push_back(earg->llValue());
         }
 
-        thing = prgm.thing<STVThing>(prgm.builder.CreateCall(callee, args, "callResult"),
-                                        (TypeThing *)NULL /* TODO IMPLEMENT */);
+        auto call = prgm.builder.CreateCall(callee, args, "callResult");
+        if (auto fn = llvm::dyn_cast<llvm::Function>(callee)) {
+            call->setCallingConv(fn->getCallingConv());
+        }
+
+        thing = prgm.thing<STVThing>(call, calleeThing->returnType());
     }
     virtual void visit(MthdCallExpr *expr) {
         assert(false && "Unimplemented");
@@ -137,6 +136,8 @@ public:
             value = prgm.builder.CreateURem(lhs->llValue(), rhs->llValue(), "modResult");
         } break;
         }
+
+        thing = prgm.thing<STVThing>(value, lhs->typeOf());
     }
     virtual void visit(IfExpr *expr) {
         thing = genIf(prgm, expr->branches.data(), expr->branches.size());
@@ -153,15 +154,16 @@ public:
     ValueThing *thing = NULL;
 
     virtual void visit(DeclarationStmt *stmt) {
-        auto alloca = prgm.builder.CreateAlloca(prgm.getType(prgm.scope, stmt->type)->llType(),
-                                               nullptr, stmt->name.data);
+        auto type = prgm.getType(prgm.scope, stmt->type);
+        auto alloca = prgm.frameSlot(type->llType(), stmt->name.data);
 
         // TODO: Allow undefined variables
         auto expr = genExpr(prgm, *stmt->value);
         prgm.builder.CreateStore(expr->llValue(), alloca);
 
         prgm.scope->addThing(stmt->name,
-                           prgm.thing<STVThing>(alloca, expr->typeOf()));
+                           prgm.thing<VarThing>(alloca, type));
+        if (prgm.debug) prgm.debug->declare(alloca, stmt->name, stmt->type, stmt->loc, 0);
 
         thing = NULL;
     }
@@ -170,8 +172,11 @@ public:
     }
     virtual void visit(ReturnStmt *stmt) {
         if (stmt->value != nullptr) {
-            prgm.builder.CreateRet(genExpr(prgm, *stmt->value)->llValue());
+            auto value = genExpr(prgm, *stmt->value)->llValue();
+            instrumentExit(prgm);
+            prgm.builder.CreateRet(value);
         } else {
+            instrumentExit(prgm);
             prgm.builder.CreateRetVoid();
         }
 
@@ -182,6 +187,23 @@ public:
     }
 };
 
+// Generate the body of a branch in a scope of its own, returning the value
+// of its last statement
+static ValueThing *genBlock(Program &prgm, std::vector<std::unique_ptr<Stmt>> &body) {
+    prgm.beginBlockScope();
+    ValueThing *value = NULL;
+    for (auto &stmt : body) {
+        value = genStmt(prgm, *stmt);
+    }
+
+    // The value may be a variable of the block, which is dead once it ends
+    if (value != NULL) {
+        value = prgm.thing<STVThing>(value->llValue(), value->typeOf());
+    }
+    prgm.endBlockScope();
+    return value;
+}
+
 ValueThing *genIf(Program &prgm, Branch *branches, size_t count) {
     if (count > 0) {
         if (branches[0].cond != NULL) {
@@ -189,21 +211,24 @@ ValueThing *genIf(Program &prgm, Branch *branches, size_t count) {
             auto alt = llvm::BasicBlock::Create(prgm.context, "ifAlt", prgm.fn);
             auto after = llvm::BasicBlock::Create(prgm.context, "afterIf", prgm.fn);
 
+            auto counter = profileBranch(prgm);
             auto cond = genExpr(prgm, *branches[0].cond);
 
-            prgm.builder.CreateCondBr(cond->llValue(), cons, alt);
+            prgm.builder.CreateCondBr(cond->llValue(), cons, alt, profileWeights(prgm, counter));
 
             // Generate the body
             prgm.builder.SetInsertPoint(cons);
-            ValueThing *consVal = NULL;
-            for (auto &stmt : branches[0].body) {
-                consVal = genStmt(prgm, *stmt);
-            }
+            profileEdge(prgm, counter);
+            ValueThing *consVal = genBlock(prgm, branches[0].body);
+            // The body may have ended in a different block, if it contained an if
+            auto consEnd = prgm.builder.GetInsertBlock();
             prgm.builder.CreateBr(after);
 
             // Generate the else expression
             prgm.builder.SetInsertPoint(alt);
+            profileEdge(prgm, counter + 1);
             ValueThing *altVal = genIf(prgm, branches + 1, count - 1); // TODO: Eww, pointer math
+            auto altEnd = prgm.builder.GetInsertBlock();
             prgm.builder.CreateBr(after);
 
             // Generate the after block
@@ -211,8 +236,8 @@ ValueThing *genIf(Program &prgm, Branch *branches, size_t count) {
             if (consVal != NULL && altVal != NULL) {
                 assert(consVal->typeOf() == altVal->typeOf() && "Cons val and Alt val need the same type");
                 auto phiNode = prgm.builder.CreatePHI(consVal->typeOf()->llType(), 2, "ifValue");
-                phiNode->addIncoming(consVal->llValue(), cons);
-                phiNode->addIncoming(altVal->llValue(), alt);
+                phiNode->addIncoming(consVal->llValue(), consEnd);
+                phiNode->addIncoming(altVal->llValue(), altEnd);
 
                 return prgm.thing<STVThing>(phiNode,
                                                consVal->typeOf());
@@ -224,11 +249,7 @@ ValueThing *genIf(Program &prgm, Branch *branches, size_t count) {
 
         } else {
             // The else branch. It is unconditional
-            ValueThing *consVal = NULL;
-            for (auto &stmt : branches[0].body) {
-                consVal = genStmt(prgm, *stmt);
-            }
-            return consVal;
+            return genBlock(prgm, branches[0].body);
         }
     } else {
         return NULL;
@@ -236,16 +257,28 @@ ValueThing *genIf(Program &prgm, Branch *branches, size_t count) {
 }
 
 inline ValueThing *genExpr(Program &prgm, Expr &expr) {
+    // Attribute the expression to its own position, and go back to the
+    // position of the enclosing expression afterwards
+    auto outer = prgm.builder.getCurrentDebugLocation();
+    if (prgm.debug) prgm.debug->setLocation(expr.loc);
+
     ExprGen eg(prgm);
     expr.accept(eg);
 
+    if (prgm.debug) prgm.builder.SetCurrentDebugLocation(outer);
+
     // if (eg.thing == NULL)
     //     std::cerr << "** NULL: " << expr << "\n";
     return eg.thing;
 }
 
 inline ValueThing *genStmt(Program &prgm, Stmt &stmt) {
+    auto outer = prgm.builder.getCurrentDebugLocation();
+    if (prgm.debug) prgm.debug->setLocation(stmt.loc);
+
     StmtGen sg(prgm);
     stmt.accept(sg);
+
+    if (prgm.debug) prgm.builder.SetCurrentDebugLocation(outer);
     return sg.thing;
 }
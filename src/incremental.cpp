@@ -0,0 +1,346 @@
+#include "incremental.h"
+#include "cache.h"
+#include "lexer.h"
+#include "parse.h"
+#include "specialize.h"
+#include "split.h"
+#include "stats.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+static std::string md5(const std::string &data) {
+    llvm::MD5 hash;
+    hash.update(data);
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    llvm::SmallString<32> str;
+    llvm::MD5::stringifyResult(result, str);
+    return str.str().str();
+}
+
+static bool fileExists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+static void showProto(std::ostream &os, FunctionProto &proto) {
+    os << proto.name << "(";
+    for (auto &arg : proto.arguments) {
+        os << arg << ", ";
+    }
+    os << "): " << proto.returnType;
+}
+
+// Computes the database key of each function of a program
+struct FunctionKeys {
+    Program &prgm;
+    std::string base;
+    std::unordered_map<istr, Item *> globals;
+
+    FunctionKeys(Program &prgm, const Options &opts, std::vector<std::unique_ptr<Item>> &items) : prgm(prgm) {
+        std::ostringstream os;
+        os << compilerVersion << "\n"
+           << llvm::sys::getDefaultTargetTriple() << "\n"
+           << llvm::sys::getHostCPUName().str() << "\n"
+           << opts.optLevel << " " << opts.instrument << " " << wantsSpecialize(opts) << "\n";
+
+        for (auto path : { &opts.profileUse, &opts.symbolOrderingFile }) {
+            if (path->empty()) continue;
+            std::ifstream file(*path, std::ios::binary);
+            std::ostringstream data;
+            data << file.rdbuf();
+            os << data.str() << "\n";
+        }
+
+        for (auto &item : items) {
+            if (auto fnItem = dynamic_cast<FunctionItem *>(item.get())) {
+                globals[fnItem->proto.name] = item.get();
+            } else if (auto ffiItem = dynamic_cast<FFIFunctionItem *>(item.get())) {
+                globals[ffiItem->proto.name] = item.get();
+            } else {
+                // A struct may be used by any function
+                os << *item << "\n";
+            }
+        }
+        base = os.str();
+    }
+
+    // How the function name looks from a caller
+    void showCallee(std::ostream &os, istr name) {
+        os << name;
+        auto found = globals.find(name);
+        if (found == globals.end()) return;
+
+        if (auto fnItem = dynamic_cast<FunctionItem *>(found->second)) {
+            os << (fnItem->exported ? " pub " : " ");
+            showProto(os, fnItem->proto);
+        } else {
+            os << " " << *found->second;
+        }
+
+        auto effects = prgm.effects.find(name);
+        if (effects != prgm.effects.end()) {
+            os << " " << effects->second.memory << " " << effects->second.mayUnwind << " " << effects->second.cold;
+        }
+        os << " " << prgm.addressTaken.count(name);
+    }
+
+    std::string key(FunctionItem *item) {
+        std::ostringstream os;
+        os << base << *item << "\n";
+        showCallee(os, item->proto.name);
+        os << "\n";
+
+        auto names = globalReferences(item);
+        std::sort(names.begin(), names.end(), [](istr a, istr b) {
+            return strcmp(a.data, b.data) < 0;
+        });
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        for (auto name : names) {
+            showCallee(os, name);
+            os << "\n";
+        }
+        return md5(os.str());
+    }
+};
+
+// Globals of the module which are lowered into one object
+struct Unit {
+    std::unordered_set<std::string> names;
+    std::string path;
+};
+
+// The function a group of globals belongs to, if it is one function and
+// local variables which only it uses, such as its string literals and its
+// -finstrument record, or NULL. Those are stored in the database with it.
+static llvm::Function *groupFunction(const std::vector<llvm::GlobalValue *> &group) {
+    llvm::Function *function = NULL;
+    for (auto gv : group) {
+        if (auto fn = llvm::dyn_cast<llvm::Function>(gv)) {
+            if (function != NULL) return NULL;
+            function = fn;
+        } else if (! gv->hasLocalLinkage()) {
+            return NULL;
+        }
+    }
+    return function;
+}
+
+// Lower each unit into its object. The module is split in half until each
+// piece holds one unit, so that only O(n log n) of it is copied.
+static bool lowerUnits(llvm::Module &mod, llvm::TargetMachine &targetMachine, unsigned optLevel,
+                       std::vector<Unit>::iterator begin, std::vector<Unit>::iterator end, std::string &error) {
+    auto keep = [](std::vector<Unit>::iterator from, std::vector<Unit>::iterator to) {
+        auto names = std::make_shared<std::unordered_set<std::string>>();
+        for (auto unit = from; unit != to; ++unit) {
+            names->insert(unit->names.begin(), unit->names.end());
+        }
+        return [names](const llvm::GlobalValue &gv) { return names->count(gv.getName().str()) != 0; };
+    };
+
+    if (end - begin > 1) {
+        auto mid = begin + (end - begin) / 2;
+        std::unique_ptr<llvm::Module> copy(llvm::CloneModule(&mod));
+        keepOnly(*copy, keep(begin, mid));
+        if (! lowerUnits(*copy, targetMachine, optLevel, begin, mid, error)) return false;
+
+        keepOnly(mod, keep(mid, end));
+        return lowerUnits(mod, targetMachine, optLevel, mid, end, error);
+    }
+
+    TimeScope scope("lower-unit", begin->path);
+    optimizeModule(mod, targetMachine, optLevel);
+
+    // Database entries are renamed into place, so that a crash never leaves
+    // a partial one behind
+    std::string tmp = begin->path + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) {
+        error = "could not write " + begin->path;
+        return false;
+    }
+    close(fd);
+
+    bool failed;
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(tmp, ec, llvm::sys::fs::F_None);
+        failed = ec || emitFile(mod, targetMachine, os, llvm::TargetMachine::CGFT_ObjectFile);
+    }
+    if (failed || rename(tmp.c_str(), begin->path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        error = "could not write " + begin->path;
+        return false;
+    }
+    return true;
+}
+
+// Remove the entries of the database which the latest compile didn't use
+static void prune(const std::string &dir, const std::unordered_set<std::string> &used) {
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) return;
+    while (struct dirent *ent = readdir(d)) {
+        if (ent->d_name[0] == '.') continue;
+        auto path = dir + "/" + ent->d_name;
+        if (used.count(path) == 0) unlink(path.c_str());
+    }
+    closedir(d);
+}
+
+bool compileIncremental(CompilerContext &cc, const Options &opts, llvm::SmallVectorImpl<char> &buffer,
+                        std::ostream &diag) {
+    auto &input = opts.inputs[0];
+    std::ifstream in(input);
+    if (! in) {
+        diag << "cppl: could not open " << input << "\n";
+        return false;
+    }
+
+    CodegenOptions options;
+    if (! codegenOptions(opts, options, diag)) return false;
+    options.hidePrivate = true;
+    options.sourcePath = input;
+
+    std::vector<std::unique_ptr<Item>> items;
+    {
+        TimeScope scope("parse");
+        StatsPhase phase("parse");
+        Lexer lex(&in);
+        items = parse(&lex);
+    }
+    // The clones are functions like any other, and get entries of their own
+    if (options.specialize) {
+        TimeScope scope("specialize");
+        StatsPhase phase("specialize");
+        specializeFunctions(items);
+    }
+
+    llvm::LLVMContext context;
+    Program prgm(context);
+    prgm.options = options;
+    prgm.diag = &diag;
+    {
+        TimeScope scope("addItems");
+        StatsPhase phase("addItems");
+        prgm.addItems(items);
+    }
+
+    // Each source has its own database, named after its absolute path
+    char absolute[PATH_MAX];
+    auto dir = opts.incrementalDir + "/" + md5(realpath(input.c_str(), absolute) ? absolute : input);
+    mkdir(opts.incrementalDir.c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+
+    // Only generate the functions which aren't in the database
+    std::vector<std::string> functions;
+    std::unordered_map<std::string, std::string> paths;
+    {
+        TimeScope scope("incremental-keys");
+        FunctionKeys keys(prgm, opts, items);
+        for (auto &item : items) {
+            auto fnItem = dynamic_cast<FunctionItem *>(item.get());
+            if (fnItem == NULL) continue;
+
+            auto name = fnItem->proto.name.data;
+            auto path = dir + "/" + keys.key(fnItem) + ".o";
+            functions.push_back(name);
+            paths[name] = path;
+            if (fileExists(path)) prgm.bodiesElsewhere.insert(fnItem->proto.name);
+        }
+    }
+
+    {
+        TimeScope scope("finalize");
+        StatsPhase phase("finalize");
+        prgm.finalize();
+    }
+    std::unique_ptr<llvm::Module> mod(prgm.module);
+    mod->setModuleIdentifier(input);
+
+    std::string error;
+    auto targetMachine = cc.targetMachine(*mod, opts.optLevel, error);
+    if (! targetMachine) {
+        diag << "cppl: " << error << "\n";
+        return false;
+    }
+
+    // Every new function is lowered on its own into the database, along with
+    // the variables only it uses. Anything which has to be lowered with
+    // something else, such as functions sharing a global, is lowered together
+    // into a temporary object every time.
+    auto groups = symbolGroups(*mod);
+    std::vector<Unit> units;
+    Unit rest;
+    std::vector<unsigned> unitOf(groups.size());
+    std::unordered_set<std::string> inRest;
+    for (size_t i=0; i<groups.size(); i++) {
+        auto &group = groups[i];
+        bool defines = false;
+        for (auto gv : group) {
+            if (! gv->isDeclaration()) defines = true;
+        }
+        if (! defines) continue;
+
+        auto function = groupFunction(group);
+        auto name = function != NULL ? function->getName().str() : "";
+        if (function != NULL && ! function->isDeclaration() && paths.count(name) != 0) {
+            unitOf[i] = units.size();
+            units.push_back({ {}, paths[name] });
+            for (auto gv : group) units.back().names.insert(gv->getName().str());
+        } else {
+            unitOf[i] = UINT_MAX;
+            for (auto gv : group) {
+                rest.names.insert(gv->getName().str());
+                inRest.insert(gv->getName().str());
+            }
+        }
+    }
+    exposeCrossGroupLocals(groups, unitOf);
+
+    std::string restPath;
+    if (! rest.names.empty()) {
+        rest.path = restPath = tempPath(".o");
+        units.push_back(std::move(rest));
+    }
+
+    bool ok = units.empty() || lowerUnits(*mod, *targetMachine, opts.optLevel, units.begin(), units.end(), error);
+
+    std::vector<std::string> objects;
+    std::unordered_set<std::string> used;
+    for (auto &name : functions) {
+        if (inRest.count(name) != 0) continue;
+        objects.push_back(paths[name]);
+        used.insert(paths[name]);
+    }
+    if (! restPath.empty()) objects.push_back(restPath);
+
+    if (ok) {
+        TimeScope scope("combine-functions");
+        ok = combineObjects(objects, buffer, error);
+    }
+    if (! ok) diag << "cppl: " << error << "\n";
+
+    if (! restPath.empty()) unlink(restPath.c_str());
+    prune(dir, used);
+    return ok;
+}
@@ -0,0 +1,32 @@
+//
+//  incremental.h
+//  cppl
+//
+//  Function-granular incremental compilation (--incremental=<dir>). Each
+//  source gets a database of objects, one per function and the private
+//  variables, such as string literals, which only it uses, keyed by a hash of
+//  the function's text and of everything it depends on: the prototypes,
+//  effects and calling conventions of what it refers to, every struct, and
+//  the compiler and its flags. Only the functions without an entry are
+//  generated and lowered, each in a module of its own, and the output is
+//  linked from the database with `ld -r`.
+//
+//  Private functions are hidden rather than internal while they are
+//  compiled apart, and are made local again by the link (see split.h).
+//
+
+#ifndef __cppl__incremental__
+#define __cppl__incremental__
+
+#include "driver.h"
+
+#include <iostream>
+
+#include <llvm/ADT/SmallVector.h>
+
+// Compile the cppl input of opts into an object in buffer, reusing what it
+// can from the database. Returns false and writes to diag on failure.
+bool compileIncremental(CompilerContext &cc, const Options &opts, llvm::SmallVectorImpl<char> &buffer,
+                        std::ostream &diag);
+
+#endif /* defined(__cppl__incremental__) */
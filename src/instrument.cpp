@@ -0,0 +1,38 @@
+#include "instrument.h"
+
+// Matches struct cppl_fn_record in runtime/instrument.c
+static llvm::StructType *recordType(Program &prgm) {
+    auto type = prgm.module->getTypeByName("cppl_fn_record");
+    if (type == NULL) {
+        type = llvm::StructType::create(prgm.context, { llvm::Type::getInt8PtrTy(prgm.context),
+                                                        llvm::Type::getInt32Ty(prgm.context) },
+                                        "cppl_fn_record");
+    }
+    return type;
+}
+
+void instrumentEntry(Program &prgm, FunctionProto &proto) {
+    if (! prgm.options.instrument) return;
+
+    auto type = recordType(prgm);
+    auto record = new llvm::GlobalVariable(*prgm.module, type, false, llvm::GlobalValue::InternalLinkage,
+                                           NULL, std::string("__cppl_instr_") + proto.name.data);
+    // The runtime fills in the id when the function is first entered
+    record->setInitializer(llvm::ConstantStruct::get(type, {
+        llvm::cast<llvm::Constant>(prgm.builder.CreateGlobalStringPtr(proto.name.data)),
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(prgm.context), 0)
+    }));
+
+    auto voidTy = llvm::Type::getVoidTy(prgm.context);
+    auto enter = prgm.module->getOrInsertFunction("__cppl_instrument_enter",
+                                                  llvm::FunctionType::get(voidTy, { type->getPointerTo() }, false));
+    prgm.builder.CreateCall(enter, record);
+}
+
+void instrumentExit(Program &prgm) {
+    if (! prgm.options.instrument) return;
+
+    auto voidTy = llvm::Type::getVoidTy(prgm.context);
+    auto exit = prgm.module->getOrInsertFunction("__cppl_instrument_exit", llvm::FunctionType::get(voidTy, false));
+    prgm.builder.CreateCall(exit);
+}
@@ -0,0 +1,22 @@
+//
+//  instrument.h
+//  cppl
+//
+//  -finstrument=profile. Every generated function calls into the runtime
+//  in runtime/instrument.c when it is entered and before each return, which
+//  counts calls and cycles and writes a report at exit. The object has to
+//  be linked with libcpplrt.
+//
+
+#ifndef __cppl__instrument__
+#define __cppl__instrument__
+
+#include "prgm.h"
+
+// Emit the entry hook for the function being generated
+void instrumentEntry(Program &prgm, FunctionProto &proto);
+
+// Emit the exit hook, before a return
+void instrumentExit(Program &prgm);
+
+#endif /* defined(__cppl__instrument__) */
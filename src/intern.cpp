@@ -7,7 +7,9 @@
 //
 
 #include "intern.h"
+#include "stats.h"
 #include <unordered_set>
+#include <mutex>
 #include <assert.h>
 
 std::ostream& operator<<(std::ostream& os, istr &s) {
@@ -15,12 +17,29 @@ std::ostream& operator<<(std::ostream& os, istr &s) {
 }
 
 // TODO: This sucks balls right now, should be improved
-std::unordered_set<std::string> stringPool;
+// The pool is constructed on first use, as intern is called from the
+// static initializers of other translation units (e.g. TYPE_NULL)
+typedef std::unordered_set<std::string, std::hash<std::string>, std::equal_to<std::string>,
+                           CountingAllocator<std::string, ALLOC_INTERN>> StringPool;
+static StringPool &pool() {
+    static StringPool stringPool;
+    return stringPool;
+}
+
+std::mutex stringPoolLock;
 istr intern(std::string string) {
+    std::lock_guard<std::mutex> guard(stringPoolLock);
+    auto &stringPool = pool();
     auto interned = stringPool.find(string);
     if (interned == stringPool.end()) {
-        stringPool.insert(string);
-        interned = stringPool.find(string);
+        interned = stringPool.insert(string).first;
+
+        // The characters are only allocated separately when the string is
+        // too long to be stored inline
+        auto chars = interned->data();
+        if (chars < (const char *) &*interned || chars >= (const char *) (&*interned + 1)) {
+            countAllocation(ALLOC_INTERN, interned->capacity() + 1);
+        }
     }
 
     return { interned->data(), interned->length() };
@@ -0,0 +1,490 @@
+#include "interp.h"
+#include "driver.h"
+#include "jit.h"
+#include "prgm.h"
+
+#include <cstring>
+#include <dlfcn.h>
+#include <assert.h>
+
+// Native functions are called through a single family of function pointer
+// types: every argument is passed as integer words (a string is its data
+// pointer followed by its length), and the result is read as a pair of
+// words. On the SysV x86-64 and AArch64 ABIs this matches how both C and
+// LLVM pass our i8-i64, boolean and string types in registers.
+struct NativeResult {
+    int64_t a, b;
+};
+
+static const unsigned MAX_NATIVE_WORDS = 6;
+static const uint32_t NO_REG = ~0u;
+
+static ValueKind kindOf(Type &type) {
+    const char *name = type.ident.data;
+    if (strcmp(name, "void") == 0) return VALUE_VOID;
+    if (strcmp(name, "boolean") == 0) return VALUE_BOOL;
+    if (strcmp(name, "i8") == 0) return VALUE_I8;
+    if (strcmp(name, "i16") == 0) return VALUE_I16;
+    if (strcmp(name, "i32") == 0) return VALUE_I32;
+    if (strcmp(name, "i64") == 0) return VALUE_I64;
+    if (strcmp(name, "string") == 0) return VALUE_STRING;
+    return VALUE_UNSUPPORTED;
+}
+
+// Returns the number of native words needed to pass the arguments, or
+// MAX_NATIVE_WORDS + 1 if they can't be passed natively
+static unsigned classify(FunctionProto &proto, std::vector<ValueKind> &argKinds, ValueKind &retKind) {
+    unsigned words = 0;
+    for (auto &arg : proto.arguments) {
+        auto kind = kindOf(arg.type);
+        if (kind == VALUE_UNSUPPORTED || kind == VALUE_VOID) return MAX_NATIVE_WORDS + 1;
+        words += kind == VALUE_STRING ? 2 : 1;
+        argKinds.push_back(kind);
+    }
+
+    retKind = kindOf(proto.returnType);
+    if (retKind == VALUE_UNSUPPORTED) return MAX_NATIVE_WORDS + 1;
+    return words;
+}
+
+static Value callNative(void *fn, const std::vector<ValueKind> &argKinds, ValueKind retKind, Value *args) {
+    int64_t w[MAX_NATIVE_WORDS];
+    unsigned n = 0;
+    for (size_t i=0; i<argKinds.size(); i++) {
+        if (argKinds[i] == VALUE_STRING) {
+            w[n++] = (int64_t) args[i].data;
+            w[n++] = args[i].length;
+        } else {
+            w[n++] = args[i].i;
+        }
+    }
+
+    typedef int64_t W;
+    NativeResult r;
+    switch (n) {
+    case 0: r = ((NativeResult (*)())fn)(); break;
+    case 1: r = ((NativeResult (*)(W))fn)(w[0]); break;
+    case 2: r = ((NativeResult (*)(W, W))fn)(w[0], w[1]); break;
+    case 3: r = ((NativeResult (*)(W, W, W))fn)(w[0], w[1], w[2]); break;
+    case 4: r = ((NativeResult (*)(W, W, W, W))fn)(w[0], w[1], w[2], w[3]); break;
+    case 5: r = ((NativeResult (*)(W, W, W, W, W))fn)(w[0], w[1], w[2], w[3], w[4]); break;
+    case 6: r = ((NativeResult (*)(W, W, W, W, W, W))fn)(w[0], w[1], w[2], w[3], w[4], w[5]); break;
+    default: assert(false && "Too many arguments for a native call");
+    }
+
+    Value v;
+    v.length = 0;
+    switch (retKind) {
+    case VALUE_VOID: v.i = 0; break;
+    case VALUE_BOOL: v.i = r.a & 1; break;
+    case VALUE_I8: v.i = (int8_t) r.a; break;
+    case VALUE_I16: v.i = (int16_t) r.a; break;
+    case VALUE_I32: v.i = (int32_t) r.a; break;
+    case VALUE_I64: v.i = r.a; break;
+    case VALUE_STRING: v.data = (const char *) r.a; v.length = r.b; break;
+    case VALUE_UNSUPPORTED: assert(false && "Unsupported return type");
+    }
+    return v;
+}
+
+static double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/***********************
+ * Bytecode generation *
+ ***********************/
+
+// Compiles the body of a single function. Arguments live in the first
+// registers, then declared locals, with temporaries above them which are
+// released at the end of each statement.
+struct BytecodeGen : public ExprVisitor, public StmtVisitor {
+    Interpreter &interp;
+    BcFunction &fn;
+
+    std::vector<std::unordered_map<istr, uint32_t>> scopes;
+    uint32_t liveTop = 0;
+    uint32_t nextReg = 0;
+
+    // The register of the last expression visited
+    uint32_t reg = NO_REG;
+    // Where the value of the next ExprStmt should go, if it is the value of a block
+    uint32_t valueDst = NO_REG;
+
+    BytecodeGen(Interpreter &interp, BcFunction &fn) : interp(interp), fn(fn) {}
+
+    uint32_t alloc(uint32_t count = 1) {
+        uint32_t r = nextReg;
+        nextReg += count;
+        if (nextReg > fn.numRegs) fn.numRegs = nextReg;
+        return r;
+    }
+
+    size_t emit(Opcode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint8_t d = 0) {
+        fn.code.push_back({ op, d, a, b, c });
+        return fn.code.size() - 1;
+    }
+
+    uint32_t expr(Expr &e) {
+        reg = NO_REG;
+        e.accept(*this);
+        assert(reg != NO_REG && "Expression has no value");
+        return reg;
+    }
+
+    void exprInto(Expr &e, uint32_t dst) {
+        auto r = expr(e);
+        if (r != dst) emit(OP_MOV, dst, r);
+    }
+
+    void stmt(Stmt &s) {
+        s.accept(*this);
+        valueDst = NO_REG;
+        nextReg = liveTop;
+    }
+
+    // Compile a block, putting its value (if it has one) into dst
+    void block(std::vector<std::unique_ptr<Stmt>> &body, uint32_t dst) {
+        auto savedLiveTop = liveTop;
+        liveTop = nextReg;
+        scopes.emplace_back();
+
+        for (size_t i=0; i<body.size(); i++) {
+            if (i + 1 == body.size()) valueDst = dst;
+            stmt(*body[i]);
+        }
+
+        scopes.pop_back();
+        nextReg = liveTop;
+        liveTop = savedLiveTop;
+    }
+
+    void function(FunctionItem &item) {
+        scopes.emplace_back();
+        for (auto &arg : item.proto.arguments) {
+            scopes.back()[arg.name] = alloc();
+        }
+        liveTop = nextReg;
+
+        for (auto &s : item.body) {
+            stmt(*s);
+        }
+        emit(OP_RETV);
+    }
+
+    virtual void visit(StringExpr *e) {
+        reg = alloc();
+        emit(OP_LOADS, reg, interp.strings.size());
+        interp.strings.push_back(e->value);
+    }
+    virtual void visit(IntExpr *e) {
+        reg = alloc();
+        emit(OP_LOADI, reg, (uint32_t) e->value);
+    }
+    virtual void visit(BoolExpr *e) {
+        reg = alloc();
+        emit(OP_LOADI, reg, e->value ? 1 : 0);
+    }
+    virtual void visit(MkExpr *) {
+        assert(false && "Unimplemented");
+    }
+    virtual void visit(CallExpr *e) {
+        auto callee = dynamic_cast<IdentExpr *>(e->callee.get());
+        assert(callee != NULL && "Only direct calls are supported");
+
+        auto argStart = alloc(e->args.size());
+        for (size_t i=0; i<e->args.size(); i++) {
+            exprInto(*e->args[i], argStart + i);
+        }
+
+        auto dst = alloc();
+        auto fnFound = interp.functionIdx.find(callee->ident);
+        if (fnFound != interp.functionIdx.end()) {
+            emit(OP_CALL, dst, fnFound->second, argStart, e->args.size());
+        } else {
+            auto ffiFound = interp.ffiIdx.find(callee->ident);
+            assert(ffiFound != interp.ffiIdx.end() && "Call to unknown function");
+            emit(OP_FFICALL, dst, ffiFound->second, argStart, e->args.size());
+        }
+        reg = dst;
+    }
+    virtual void visit(MthdCallExpr *) {
+        assert(false && "Unimplemented");
+    }
+    virtual void visit(MemberExpr *) {
+        assert(false && "Unimplemented");
+    }
+    virtual void visit(IdentExpr *e) {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            auto found = scope->find(e->ident);
+            if (found != scope->end()) {
+                reg = found->second;
+                return;
+            }
+        }
+        assert(false && "Unknown identifier");
+    }
+    virtual void visit(InfixExpr *e) {
+        auto lhs = expr(*e->lhs);
+        auto rhs = expr(*e->rhs);
+
+        Opcode op = OP_ADD;
+        switch (e->op) {
+        case OPERATION_PLUS: op = OP_ADD; break;
+        case OPERATION_MINUS: op = OP_SUB; break;
+        case OPERATION_TIMES: op = OP_MUL; break;
+        case OPERATION_DIVIDE: op = OP_DIV; break;
+        case OPERATION_MODULO: op = OP_MOD; break;
+        }
+
+        reg = alloc();
+        emit(op, reg, lhs, rhs);
+    }
+    virtual void visit(IfExpr *e) {
+        auto dst = alloc();
+        std::vector<size_t> toEnd;
+
+        for (auto &branch : e->branches) {
+            if (branch.cond != nullptr) {
+                auto cond = expr(*branch.cond);
+                auto skip = emit(OP_JMPF, cond);
+                block(branch.body, dst);
+                toEnd.push_back(emit(OP_JMP));
+                fn.code[skip].b = fn.code.size();
+            } else {
+                block(branch.body, dst);
+            }
+        }
+
+        for (auto jmp : toEnd) {
+            fn.code[jmp].a = fn.code.size();
+        }
+        reg = dst;
+    }
+
+    virtual void visit(DeclarationStmt *s) {
+        auto r = alloc();
+        liveTop = nextReg;
+        exprInto(*s->value, r);
+        scopes.back()[s->name] = r;
+    }
+    virtual void visit(ExprStmt *s) {
+        auto dst = valueDst;
+        valueDst = NO_REG;
+        if (dst != NO_REG) {
+            exprInto(*s->expr, dst);
+        } else {
+            expr(*s->expr);
+        }
+    }
+    virtual void visit(ReturnStmt *s) {
+        if (s->value != nullptr) {
+            emit(OP_RET, expr(*s->value));
+        } else {
+            emit(OP_RETV);
+        }
+    }
+    virtual void visit(EmptyStmt *) {}
+};
+
+/***************
+ * Interpreter *
+ ***************/
+
+Interpreter::Interpreter(std::vector<std::unique_ptr<Item>> items, unsigned threshold, unsigned optLevel)
+    : items(std::move(items)), threshold(threshold), optLevel(optLevel),
+      stack(1 << 20), created(std::chrono::steady_clock::now()) {}
+
+Interpreter::~Interpreter() {
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            shutdown = true;
+        }
+        wakeup.notify_one();
+        worker.join();
+    }
+}
+
+bool Interpreter::load(std::string &error) {
+    // Register every function first, so that calls can be resolved
+    // regardless of declaration order
+    std::vector<FunctionItem *> bodies;
+    for (auto &item : items) {
+        if (auto fnItem = dynamic_cast<FunctionItem *>(item.get())) {
+            auto fn = std::make_unique<BcFunction>();
+            fn->proto = &fnItem->proto;
+            fn->promotable = classify(fnItem->proto, fn->argKinds, fn->retKind) <= MAX_NATIVE_WORDS;
+            functionIdx[fnItem->proto.name] = functions.size();
+            functions.push_back(std::move(fn));
+            bodies.push_back(fnItem);
+        } else if (auto ffiItem = dynamic_cast<FFIFunctionItem *>(item.get())) {
+            FFIFunction ffi;
+            ffi.proto = &ffiItem->proto;
+            if (classify(ffiItem->proto, ffi.argKinds, ffi.retKind) > MAX_NATIVE_WORDS) {
+                error = std::string("cannot call FFI function ") + ffiItem->proto.name.data;
+                return false;
+            }
+            ffi.addr = dlsym(RTLD_DEFAULT, ffiItem->proto.name.data);
+            if (ffi.addr == NULL) {
+                error = std::string("unresolved FFI function ") + ffiItem->proto.name.data;
+                return false;
+            }
+            ffiIdx[ffiItem->proto.name] = ffiFunctions.size();
+            ffiFunctions.push_back(ffi);
+        }
+    }
+
+    for (size_t i=0; i<bodies.size(); i++) {
+        BytecodeGen gen(*this, *functions[i]);
+        gen.function(*bodies[i]);
+    }
+
+    loadMs = msSince(created);
+    return true;
+}
+
+int Interpreter::runMain(std::string &error) {
+    auto found = functionIdx.find(intern("main"));
+    if (found == functionIdx.end()) {
+        error = "no main function";
+        return 1;
+    }
+    auto &mainFn = *functions[found->second];
+    if (! mainFn.proto->arguments.empty()) {
+        error = "main may not take arguments";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = call(mainFn, NULL);
+    runMs = msSince(start);
+
+    return (int) result.i;
+}
+
+Value Interpreter::call(BcFunction &fn, Value *args) {
+    if (void *native = fn.native.load(std::memory_order_acquire)) {
+        return callNative(native, fn.argKinds, fn.retKind, args);
+    }
+
+    if (++fn.calls == threshold && fn.promotable) {
+        promote(fn);
+    }
+
+    if (top + fn.numRegs > stack.size()) {
+        std::cerr << "cppl: interpreter stack overflow\n";
+        abort();
+    }
+
+    Value *regs = &stack[top];
+    std::copy(args, args + fn.argKinds.size(), regs);
+    top += fn.numRegs;
+    auto result = run(fn, regs);
+    top -= fn.numRegs;
+
+    return result;
+}
+
+Value Interpreter::run(BcFunction &fn, Value *r) {
+    const Insn *code = fn.code.data();
+    const Insn *pc = code;
+
+    for (;;) {
+        const Insn &i = *pc++;
+        switch (i.op) {
+        case OP_LOADI: r[i.a].i = (int32_t) i.b; break;
+        case OP_LOADS: {
+            r[i.a].data = strings[i.b].data;
+            r[i.a].length = strings[i.b].length;
+        } break;
+        case OP_MOV: r[i.a] = r[i.b]; break;
+
+        // Arithmetic has the same semantics as the generated code: 32-bit
+        // wrapping, with unsigned division and remainder
+        case OP_ADD: r[i.a].i = (int32_t) ((uint32_t) r[i.b].i + (uint32_t) r[i.c].i); break;
+        case OP_SUB: r[i.a].i = (int32_t) ((uint32_t) r[i.b].i - (uint32_t) r[i.c].i); break;
+        case OP_MUL: r[i.a].i = (int32_t) ((uint32_t) r[i.b].i * (uint32_t) r[i.c].i); break;
+        case OP_DIV: r[i.a].i = (int32_t) ((uint32_t) r[i.b].i / (uint32_t) r[i.c].i); break;
+        case OP_MOD: r[i.a].i = (int32_t) ((uint32_t) r[i.b].i % (uint32_t) r[i.c].i); break;
+
+        case OP_JMP: pc = code + i.a; break;
+        case OP_JMPF: if (! r[i.a].i) pc = code + i.b; break;
+
+        case OP_CALL: r[i.a] = call(*functions[i.b], &r[i.c]); break;
+        case OP_FFICALL: {
+            auto &ffi = ffiFunctions[i.b];
+            r[i.a] = callNative(ffi.addr, ffi.argKinds, ffi.retKind, &r[i.c]);
+        } break;
+
+        case OP_RET: return r[i.a];
+        case OP_RETV: {
+            Value v;
+            v.i = 0;
+            v.length = 0;
+            return v;
+        }
+        }
+    }
+}
+
+void Interpreter::promote(BcFunction &fn) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (engineFailed) return;
+
+    queue.push_back(&fn);
+    if (! worker.joinable()) {
+        worker = std::thread([this]() { compileLoop(); });
+    }
+    wakeup.notify_one();
+}
+
+void Interpreter::compileLoop() {
+    for (;;) {
+        BcFunction *fn;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wakeup.wait(guard, [this]() { return shutdown || ! queue.empty(); });
+            if (shutdown) return;
+            fn = queue.front();
+            queue.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        // The whole program is lowered and handed to MCJIT the first time
+        // anything gets hot. Functions are compiled on demand after that.
+        if (! engine) {
+            Program prgm(context);
+            // Promoted functions are looked up by name and called through the C ABI
+            prgm.options.exportAll = true;
+            prgm.addItems(items);
+            prgm.finalize();
+
+            std::string error;
+            engine = createJIT(std::unique_ptr<llvm::Module>(prgm.module), optLevel, true, error);
+            if (! engine) {
+                std::cerr << "cppl: could not start JIT: " << error << "\n";
+                std::lock_guard<std::mutex> guard(lock);
+                engineFailed = true;
+                return;
+            }
+        }
+
+        auto addr = engine->getFunctionAddress(fn->proto->name.data);
+        fn->compileMs = msSince(start);
+        if (addr != 0) {
+            fn->native.store((void *) addr, std::memory_order_release);
+        }
+    }
+}
+
+void Interpreter::printStats(std::ostream &os) {
+    os << "tier: bytecode load " << loadMs << "ms, run " << runMs << "ms\n";
+    for (auto &fn : functions) {
+        if (fn->native.load(std::memory_order_acquire) != nullptr) {
+            os << "tier: promoted " << fn->proto->name << " after " << threshold
+               << " calls (compiled in " << fn->compileMs << "ms)\n";
+        }
+    }
+}
@@ -0,0 +1,146 @@
+//
+//  interp.h
+//  cppl
+//
+//  A register based bytecode interpreter, used as the first execution tier
+//  of --interp. Functions which are called often enough are compiled with
+//  MCJIT on a background thread, after which the interpreter dispatches
+//  calls to them through the native entry in the function table.
+//
+
+#ifndef __cppl__interp__
+#define __cppl__interp__
+
+#include "ast.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/LLVMContext.h>
+
+enum Opcode : uint8_t {
+    OP_LOADI,   // r[a] = int(b)
+    OP_LOADS,   // r[a] = strings[b]
+    OP_MOV,     // r[a] = r[b]
+    OP_ADD,     // r[a] = r[b] + r[c]
+    OP_SUB,     // r[a] = r[b] - r[c]
+    OP_MUL,     // r[a] = r[b] * r[c]
+    OP_DIV,     // r[a] = r[b] / r[c]
+    OP_MOD,     // r[a] = r[b] % r[c]
+    OP_JMP,     // goto a
+    OP_JMPF,    // if (! r[a]) goto b
+    OP_CALL,    // r[a] = functions[b](r[c], ..., r[c + d - 1])
+    OP_FFICALL, // r[a] = ffiFunctions[b](r[c], ..., r[c + d - 1])
+    OP_RET,     // return r[a]
+    OP_RETV     // return
+};
+
+struct Insn {
+    Opcode op;
+    uint8_t d;
+    uint32_t a, b, c;
+};
+
+struct Value {
+    union {
+        int64_t i;
+        const char *data;
+    };
+    int64_t length; // Only meaningful for strings
+};
+
+// How a value of a cppl type is passed to and returned from native code
+enum ValueKind {
+    VALUE_VOID,
+    VALUE_BOOL,
+    VALUE_I8,
+    VALUE_I16,
+    VALUE_I32,
+    VALUE_I64,
+    VALUE_STRING,
+    VALUE_UNSUPPORTED
+};
+
+struct BcFunction {
+    FunctionProto *proto;
+    std::vector<Insn> code;
+    unsigned numRegs = 0;
+
+    std::vector<ValueKind> argKinds;
+    ValueKind retKind;
+    bool promotable;
+
+    // Tiering state. native is written by the compile thread once the
+    // function has been JIT compiled, and read on every call.
+    uint64_t calls = 0;
+    std::atomic<void *> native{nullptr};
+    double compileMs = 0;
+};
+
+struct FFIFunction {
+    FunctionProto *proto;
+    void *addr;
+
+    std::vector<ValueKind> argKinds;
+    ValueKind retKind;
+};
+
+struct Interpreter {
+    std::vector<std::unique_ptr<Item>> items;
+    unsigned threshold;
+    unsigned optLevel;
+
+    std::vector<std::unique_ptr<BcFunction>> functions;
+    std::vector<FFIFunction> ffiFunctions;
+    std::vector<istr> strings;
+    std::unordered_map<istr, unsigned> functionIdx;
+    std::unordered_map<istr, unsigned> ffiIdx;
+
+    // The register file. Each frame uses numRegs registers starting at top.
+    std::vector<Value> stack;
+    size_t top = 0;
+
+    // State of the background compile thread
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::deque<BcFunction *> queue;
+    bool shutdown = false;
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::ExecutionEngine> engine;
+    bool engineFailed = false;
+
+    std::chrono::steady_clock::time_point created;
+    double loadMs = 0;
+    double runMs = 0;
+
+    // A threshold of 0 disables promotion to native code
+    Interpreter(std::vector<std::unique_ptr<Item>> items, unsigned threshold, unsigned optLevel);
+    ~Interpreter();
+
+    // Compile the items to bytecode and bind FFI functions.
+    // Returns false and sets error if the program can't be interpreted.
+    bool load(std::string &error);
+
+    // Run the main function of the program and return its exit code. Sets
+    // error if there is no main function which can be run.
+    int runMain(std::string &error);
+
+    void printStats(std::ostream &os);
+
+    Value call(BcFunction &fn, Value *args);
+    Value run(BcFunction &fn, Value *regs);
+    void promote(BcFunction &fn);
+    void compileLoop();
+};
+
+#endif /* defined(__cppl__interp__) */
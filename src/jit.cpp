@@ -0,0 +1,93 @@
+#include "jit.h"
+#include "driver.h"
+
+#include <fstream>
+#include <mutex>
+#include <unistd.h>
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/DynamicLibrary.h>
+
+// Writes the perf map file described at
+// https://github.com/torvalds/linux/blob/master/tools/perf/Documentation/jit-interface.txt
+struct PerfMapListener : public llvm::JITEventListener {
+    std::mutex lock;
+    std::ofstream file;
+
+    PerfMapListener() {
+        file.open("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ios::app);
+    }
+
+    void NotifyObjectEmitted(const llvm::object::ObjectFile &obj,
+                             const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+        // The debug object has had the load addresses of its sections applied
+        auto debugObj = info.getObjectForDebug(obj);
+        if (! debugObj.getBinary()) return;
+
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto &sym : debugObj.getBinary()->symbols()) {
+            llvm::object::SymbolRef::Type type;
+            if (sym.getType(type) || type != llvm::object::SymbolRef::ST_Function) continue;
+
+            llvm::StringRef name;
+            uint64_t addr, size;
+            if (sym.getName(name) || sym.getAddress(addr) || sym.getSize(size)) continue;
+
+            file << std::hex << addr << " " << size << std::dec << " " << name.str() << "\n";
+        }
+        file.flush();
+    }
+};
+
+std::unique_ptr<llvm::ExecutionEngine> createJIT(std::unique_ptr<llvm::Module> mod, unsigned optLevel,
+                                                 bool perfMap, std::string &error) {
+    initializeLLVM();
+
+    // Make the symbols of the host process (libc etc.) visible to the
+    // symbol resolver, so FFI functions can be bound to them
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+
+    auto targetMachine = createTargetMachine(*mod, optLevel, error);
+    if (! targetMachine) return nullptr;
+
+    optimizeModule(*mod, *targetMachine, optLevel);
+
+    llvm::EngineBuilder builder(std::move(mod));
+    builder.setErrorStr(&error)
+        .setEngineKind(llvm::EngineKind::JIT)
+        .setMCJITMemoryManager(std::make_unique<llvm::SectionMemoryManager>());
+
+    std::unique_ptr<llvm::ExecutionEngine> engine(builder.create(targetMachine.release()));
+    if (! engine) return nullptr;
+
+    if (perfMap) {
+        // The listener has to outlive every engine it is registered with
+        static PerfMapListener listener;
+        engine->RegisterJITEventListener(&listener);
+    }
+
+    return engine;
+}
+
+int runModule(std::unique_ptr<llvm::Module> mod, unsigned optLevel,
+              const std::vector<std::string> &args, std::string &error) {
+    auto engine = createJIT(std::move(mod), optLevel, true, error);
+    if (! engine) return -1;
+
+    llvm::Function *mainFn = engine->FindFunctionNamed("main");
+    if (mainFn == NULL || mainFn->isDeclaration()) {
+        error = "no main function to run";
+        return -1;
+    }
+
+    engine->finalizeObject();
+    engine->runStaticConstructorsDestructors(false);
+    int result = engine->runFunctionAsMain(mainFn, args, environ);
+    engine->runStaticConstructorsDestructors(true);
+
+    return result;
+}
@@ -0,0 +1,30 @@
+//
+//  jit.h
+//  cppl
+//
+//  In-process execution of a generated module with MCJIT.
+//
+
+#ifndef __cppl__jit__
+#define __cppl__jit__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/Module.h>
+
+// Create an MCJIT execution engine for the module. FFI functions are resolved
+// against the symbols of the host process. If perfMap is set, the address
+// ranges of the generated functions are written to /tmp/perf-<pid>.map so
+// that perf can symbolize them. Returns NULL and sets error on failure.
+std::unique_ptr<llvm::ExecutionEngine> createJIT(std::unique_ptr<llvm::Module> mod, unsigned optLevel,
+                                                 bool perfMap, std::string &error);
+
+// JIT-compile the module and call its main function with args as argv.
+// Returns the exit code of main, or -1 and sets error on failure.
+int runModule(std::unique_ptr<llvm::Module> mod, unsigned optLevel,
+              const std::vector<std::string> &args, std::string &error);
+
+#endif /* defined(__cppl__jit__) */
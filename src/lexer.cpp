@@ -10,16 +10,33 @@
 #include <vector>
 #include <assert.h>
 #include "intern.h"
+#include "timing.h"
 
 Lexer::Lexer(std::istream *input) : stream(input), cache(TOKEN_EOF) {
+    position.line = 1;
+    position.col = 1;
     cache = nextToken();
+    cache.loc = tokenStart;
+}
+
+// Read a character, keeping track of where we are
+int Lexer::get() {
+    auto c = stream->get();
+    if (c == '\n') {
+        position.line++;
+        position.col = 1;
+    } else {
+        position.col++;
+    }
+    return c;
 }
 
 // Let's do some lexing!
 
 Token Lexer::nextToken() {
     for (;;) {
-        auto first = stream->get();
+        tokenStart = position;
+        auto first = get();
         switch (first) {
         case EOF: return Token(TOKEN_EOF);
         case '(': return Token(TOKEN_LPAREN);
@@ -41,16 +58,16 @@ Token Lexer::nextToken() {
         case '"': {
             auto token = Token(TOKEN_STRING);
             std::string chrs;
-            first = stream->get();
+            first = get();
             while (first != '"') {
                 if (first == '\\') {
                     // TODO: Add special escape chars like \n and \r
-                    chrs.push_back(stream->get());
+                    chrs.push_back(get());
                 } else {
                     chrs.push_back(first);
                 }
                 // Read in the next character
-                first = stream->get();
+                first = get();
             }
             token.data.strValue = intern(chrs);
             return token;
@@ -71,7 +88,7 @@ Token Lexer::nextToken() {
                 while ('0' <= first && first <= '9') {
                     token.data.intValue *= 10;
                     token.data.intValue += first - '0';
-                    stream->get();
+                    get();
                     first = stream->peek();
                 }
 
@@ -99,7 +116,7 @@ Token Lexer::nextToken() {
                 // Record this character
                 chrs.push_back(first);
                 // Remove it from the input stream
-                stream->get();
+                get();
                 // Get the next char on file!
                 first = stream->peek();
             }
@@ -124,6 +141,14 @@ Token Lexer::nextToken() {
                 return Token(TOKEN_FALSE);
             } else if (chrs == "mk") {
                 return Token(TOKEN_MK);
+            } else if (chrs == "pure") {
+                return Token(TOKEN_PURE);
+            } else if (chrs == "const") {
+                return Token(TOKEN_CONST);
+            } else if (chrs == "pub") {
+                return Token(TOKEN_PUB);
+            } else if (chrs == "cold") {
+                return Token(TOKEN_COLD);
             }
             return token;
         }
@@ -138,7 +163,14 @@ Token Lexer::peek() {
 
 Token Lexer::eat() {
     auto token = cache;
-    cache = nextToken();
+    if (timingEnabled) {
+        auto start = std::chrono::steady_clock::now();
+        cache = nextToken();
+        recordLexTime(std::chrono::steady_clock::now() - start);
+    } else {
+        cache = nextToken();
+    }
+    cache.loc = tokenStart;
     return token;
 }
 
@@ -219,6 +251,18 @@ std::ostream& operator<<(std::ostream& os, TokenType n) {
     case TOKEN_MK: {
         os << "MK";
     } break;
+    case TOKEN_PURE: {
+        os << "PURE";
+    } break;
+    case TOKEN_CONST: {
+        os << "CONST";
+    } break;
+    case TOKEN_PUB: {
+        os << "PUB";
+    } break;
+    case TOKEN_COLD: {
+        os << "COLD";
+    } break;
     case TOKEN_IDENT: {
         os << "IDENT";
     } break;
@@ -41,6 +41,10 @@ enum TokenType {
     TOKEN_IF,
     TOKEN_ELSE,
     TOKEN_MK,
+    TOKEN_PURE,
+    TOKEN_CONST,
+    TOKEN_PUB,
+    TOKEN_COLD,
 
     // Booleans! WOO!
     TOKEN_TRUE,
@@ -55,6 +59,12 @@ enum TokenType {
 
 std::ostream& operator<<(std::ostream& os, TokenType n);
 
+// A position in the source, counting from 1. Line 0 is unknown.
+struct SourceLoc {
+    unsigned line = 0;
+    unsigned col = 0;
+};
+
 // An object representing a token
 class Token {
 public:
@@ -64,6 +74,7 @@ public:
         istr ident;
         istr strValue;
     } data;
+    SourceLoc loc; // Where the token starts
 
     Token(TokenType type) : type(type) {};
 };
@@ -75,6 +86,10 @@ class Lexer {
     std::istream *stream;
     Token cache;
 
+    SourceLoc position;
+    SourceLoc tokenStart;
+
+    int get();
     Token nextToken();
 public:
     Lexer(std::istream *input);
@@ -10,144 +10,114 @@
 #include <fstream>
 #include <sstream>
 
-#include <llvm/ADT/Triple.h>
-#include <llvm/IR/DataLayout.h>
-#include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
-#include <llvm/IRReader/IRReader.h>
-#include <llvm/MC/SubtargetFeature.h>
-#include <llvm/Pass.h>
-#include <llvm/PassManager.h>
-#include <llvm/Support/Debug.h>
-#include <llvm/Support/FileSystem.h>
-#include <llvm/Support/FormattedStream.h>
-#include <llvm/Support/Host.h>
 #include <llvm/Support/ManagedStatic.h>
-#include <llvm/Support/PrettyStackTrace.h>
-#include <llvm/Support/Signals.h>
-#include <llvm/Support/SourceMgr.h>
-#include <llvm/Support/TargetRegistry.h>
-#include <llvm/Support/TargetSelect.h>
-#include <llvm/Support/ToolOutputFile.h>
-#include <llvm/Target/TargetLibraryInfo.h>
-#include <llvm/Target/TargetMachine.h>
-#include <llvm/Target/TargetSubtargetInfo.h>
 
+#include "cache.h"
+#include "driver.h"
+#include "interp.h"
+#include "jit.h"
 #include "lexer.h"
-#include "ast.h"
+#include "options.h"
 #include "parse.h"
-#include "gen.h"
-#include "prgm.h"
+#include "server.h"
+#include "stats.h"
+#include "timing.h"
+#include "watch.h"
 
-int main(int argc, const char * argv[]) {
-    // Usage Message (TODO: Improve)
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <FileName>\n"
-                  << "Compiles the file given by <FileName>\n";
-        return 1;
-    }
-
-    // Read in the file passed as the first argument
-    std::ifstream fileStream;
-    fileStream.open(argv[1]);
-
-    // We'll output to the file passed in as the second argument
-    std::error_code ec;
-    auto openflags = llvm::sys::fs::F_None;
-    auto out = std::make_unique<llvm::tool_output_file>(argv[2], ec, openflags);
+static int runMode(const Options &opts, const std::vector<std::string> &args, const char *argv0) {
+    std::string error;
 
-    if (ec) {
-        std::cerr << argv[0] << ": " << ec.message() << "\n";
-        return 1;
+    switch (opts.mode) {
+    case MODE_COMPILE: {
+        CompilerContext cc;
+        return runJob(cc, opts, std::cerr);
     }
 
-    // Parse it!
-    auto lex = Lexer(&fileStream);
-    auto stmts = parse(&lex);
-
-    // std::cout << "Result of parsing: \n";
-    // for (auto &stmt : stmts) {
-    //     std::cout << *stmt << ";\n";
-    // }
-
-    auto prgm = Program();
-    prgm.addItems(stmts);
-    prgm.finalize();
+    case MODE_RUN: {
+        CodegenOptions options;
+        if (! codegenOptions(opts, options, std::cerr)) return 1;
+
+        llvm::LLVMContext context;
+        auto mod = loadInput(context, opts.inputs[0], options, std::cerr);
+        if (! mod) return 1;
+
+        // The program sees its own path as argv[0]
+        int result = runModule(std::move(mod), opts.optLevel, opts.inputs, error);
+        if (! error.empty()) {
+            std::cerr << argv0 << ": " << error << "\n";
+            return 1;
+        }
+        return result;
+    }
 
-    auto mod = prgm.module;
+    case MODE_INTERP: {
+        std::ifstream fileStream;
+        fileStream.open(opts.inputs[0]);
+        if (! fileStream) {
+            std::cerr << argv0 << ": could not open " << opts.inputs[0] << "\n";
+            return 1;
+        }
+
+        auto lex = Lexer(&fileStream);
+        Interpreter interpreter(parse(&lex), opts.tierThreshold, opts.optLevel);
+
+        if (! interpreter.load(error)) {
+            std::cerr << argv0 << ": " << error << "\n";
+            return 1;
+        }
+
+        int result = interpreter.runMain(error);
+        if (! error.empty()) {
+            std::cerr << argv0 << ": " << error << "\n";
+            return 1;
+        }
+        if (opts.tierStats) interpreter.printStats(std::cerr);
+        return result;
+    }
 
-    /* DEBUG */
-    // mod->dump();
+    case MODE_SERVER:
+        return runServer(opts.socketPath, 0);
 
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    llvm::InitializeNativeTargetAsmParser();
+    case MODE_CLIENT:
+        return runClient(opts.socketPath, args);
 
-    llvm::PassRegistry *registry = llvm::PassRegistry::getPassRegistry();
-    llvm::initializeCore(*registry);
-    llvm::initializeCodeGen(*registry);
-    llvm::initializeLoopStrengthReducePass(*registry);
-    llvm::initializeLowerIntrinsicsPass(*registry);
-    llvm::initializeUnreachableBlockElimPass(*registry);
+    case MODE_CACHE_STATS: {
+        ObjectCache cache(opts.cacheDir, opts.cacheSize);
+        cache.printStats(std::cout);
+        return 0;
+    }
 
-    llvm::Triple targetTriple(mod->getTargetTriple());
-    if (targetTriple.getTriple().empty()) {
-        targetTriple.setTriple(llvm::sys::getDefaultTargetTriple());
+    case MODE_WATCH:
+        return runWatch(opts, std::cerr);
     }
+    return 1;
+}
 
-    std::cout << "Target Triple: " << targetTriple.getTriple() << "\n";
+int main(int argc, const char * argv[]) {
+    // Tear down LLVM's statics on exit, which is when it reports pass timings
+    llvm::llvm_shutdown_obj shutdown;
 
-    std::string error;
-    const llvm::Target *target = llvm::TargetRegistry::lookupTarget("", targetTriple, error);
-    if (! target) {
-        std::cerr << argv[0] << ": " << error;
-        return 1;
-    }
+    std::vector<std::string> args(argv + 1, argv + argc);
 
-    auto optLvl = llvm::CodeGenOpt::Default;
-    switch ('0') { // TEmporary
-    default:
-        std::cerr << argv[0] << ": invalid optimization level.\n";
+    Options opts;
+    std::string error;
+    if (! parseArgs(args, opts, error)) {
+        std::cerr << argv[0] << ": " << error << "\n";
+        usage(std::cerr, argv[0]);
         return 1;
-    case ' ': break;
-    case '0': optLvl = llvm::CodeGenOpt::None; break;
-    case '1': optLvl = llvm::CodeGenOpt::Less; break;
-    case '2': optLvl = llvm::CodeGenOpt::Default; break;
-    case '3': optLvl = llvm::CodeGenOpt::Aggressive; break;
     }
 
-    // llvm::TargetOptions options;
-    // TODO: llc line 268
+    // A client's compile is reported on by whoever compiles it (see runClient)
+    bool reports = opts.mode != MODE_CLIENT;
+    if (reports) beginReports(opts, true);
 
-    std::unique_ptr<llvm::TargetMachine> targetMachine(target->createTargetMachine(targetTriple.getTriple(),
-                                                                                   llvm::sys::getHostCPUName(),
-                                                                                   "",
-                                                                                   llvm::TargetOptions(),
-                                                                                   llvm::Reloc::Default,
-                                                                                   llvm::CodeModel::Default,
-                                                                                   optLvl));
-    assert(targetMachine && "Could not allocate target machine!");
+    int status = runMode(opts, args, argv[0]);
 
-    llvm::PassManager passmanager;
-    llvm::TargetLibraryInfo *TLI = new llvm::TargetLibraryInfo(targetTriple);
-    passmanager.add(TLI);
-
-    if (const llvm::DataLayout *datalayout = targetMachine->getSubtargetImpl()->getDataLayout())
-        mod->setDataLayout(datalayout);
-
-    llvm::formatted_raw_ostream ostream(out->os());
-
-    // Ask the target to add backend passes as necessary.
-    if (targetMachine->addPassesToEmitFile(passmanager, ostream, llvm::TargetMachine::CGFT_ObjectFile)) {
-        std::cerr << argv[0] << ": target does not support generation of this"
-                  << " file type!\n";
+    if (reports && ! writeReports(opts, std::cerr)) {
         return 1;
     }
 
-    passmanager.run(*mod);
-
-    out->keep();
-
-    return 0;
+    return status;
 }
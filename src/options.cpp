@@ -0,0 +1,456 @@
+#include "options.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <set>
+#include <sys/stat.h>
+
+static bool isDirectory(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool startsWith(const std::string &str, const std::string &prefix) {
+    return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+static const char *emitNames[] = { "obj", "asm", "llvm-ir", "bc" };
+static const char *emitExtensions[] = { "o", "s", "ll", "bc" };
+
+const char *emitExtension(EmitKind kind) {
+    return emitExtensions[kind];
+}
+
+// Parse the list of --emit=<kind>[=<path>],...
+static bool parseEmit(const std::string &list, std::vector<EmitOutput> &emit, std::string &error) {
+    emit.clear();
+
+    size_t start = 0;
+    while (start <= list.size()) {
+        auto end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        auto item = list.substr(start, end - start);
+        start = end + 1;
+
+        auto eq = item.find('=');
+        auto name = item.substr(0, eq);
+        std::string path = eq == std::string::npos ? "" : item.substr(eq + 1);
+
+        unsigned kind = 0;
+        while (kind < 4 && name != emitNames[kind]) kind++;
+        if (kind == 4) {
+            error = "unknown output kind " + name + ", expected obj, asm, llvm-ir or bc";
+            return false;
+        }
+        for (auto &output : emit) {
+            if (output.kind == kind) {
+                error = "output kind " + name + " given twice";
+                return false;
+            }
+        }
+        emit.push_back({ (EmitKind) kind, path });
+    }
+    return true;
+}
+
+std::vector<EmitOutput> emitOutputs(const Options &opts) {
+    auto outputs = opts.emit;
+    if (outputs.size() == 1 && outputs[0].path.empty()) {
+        outputs[0].path = opts.output;
+        return outputs;
+    }
+
+    // Swap the extension of the output for each kind's own
+    auto stem = opts.output;
+    auto dot = stem.find_last_of('.');
+    if (dot != std::string::npos && stem.find('/', dot) == std::string::npos) stem.resize(dot);
+    for (auto &output : outputs) {
+        if (output.path.empty()) output.path = stem + "." + emitExtension(output.kind);
+    }
+    return outputs;
+}
+
+std::string batchOutput(const Options &opts, const std::string &input) {
+    auto slash = input.find_last_of('/');
+    auto name = slash == std::string::npos ? input : input.substr(slash + 1);
+    auto dot = name.find_last_of('.');
+    if (dot != std::string::npos) name.resize(dot);
+
+    auto dir = opts.output;
+    if (dir.back() != '/') dir += '/';
+    return dir + name + "." + emitExtension(opts.emit[0].kind);
+}
+
+bool wantsRemarks(const Options &opts) {
+    return ! opts.remarksPassed.empty() || ! opts.remarksMissed.empty() || ! opts.remarksAnalysis.empty() ||
+        opts.remarksSummary || opts.saveOptimizationRecord;
+}
+
+bool wantsSpecialize(const Options &opts) {
+    return opts.specialize < 0 ? opts.optLevel >= 2 : opts.specialize != 0;
+}
+
+std::string optimizationRecordPath(const Options &opts) {
+    if (! opts.optimizationRecord.empty()) return opts.optimizationRecord;
+
+    auto stem = emitOutputs(opts)[0].path;
+    if (stem == "-") stem = opts.inputs[0];
+    auto dot = stem.find_last_of('.');
+    if (dot != std::string::npos && stem.find('/', dot) == std::string::npos) stem.resize(dot);
+    return stem + ".opt.yaml";
+}
+
+bool parseArgs(const std::vector<std::string> &args, Options &opts, std::string &error) {
+    std::vector<std::string> positional;
+    bool haveOutput = false;
+
+    for (size_t i=0; i<args.size(); i++) {
+        auto &arg = args[i];
+        if (startsWith(arg, "-O") && arg.size() > 2) {
+            if (arg.size() != 3 || arg[2] < '0' || arg[2] > '3') {
+                error = "invalid optimization level.";
+                return false;
+            }
+            opts.optLevel = arg[2] - '0';
+        } else if (arg == "-o") {
+            if (++i == args.size()) {
+                error = "expected a path after -o";
+                return false;
+            }
+            opts.output = args[i];
+            haveOutput = true;
+        } else if (startsWith(arg, "-j")) {
+            auto jobs = arg.size() > 2 ? arg.substr(2) : (++i < args.size() ? args[i] : "");
+            opts.jobs = atoi(jobs.c_str());
+            if (opts.jobs == 0) {
+                error = "expected a number of jobs after -j";
+                return false;
+            }
+        } else if (startsWith(arg, "--codegen-threads=")) {
+            opts.codegenThreads = atoi(arg.c_str() + 18);
+            if (opts.codegenThreads == 0) {
+                error = "expected a number of threads after --codegen-threads=";
+                return false;
+            }
+        } else if (startsWith(arg, "--incremental=")) {
+            opts.incrementalDir = arg.substr(14);
+        } else if (arg == "--stream") {
+            opts.stream = true;
+        } else if (arg == "--stream=pipeline") {
+            opts.stream = true;
+            opts.streamPipeline = true;
+        } else if (arg == "--emit-bc") {
+            opts.emit = { { EMIT_BC, "" } };
+        } else if (startsWith(arg, "--emit=")) {
+            if (! parseEmit(arg.substr(7), opts.emit, error)) return false;
+        } else if (arg == "--lto") {
+            opts.lto = true;
+        } else if (arg == "--run") {
+            // Everything after the file to run belongs to the program
+            opts.mode = MODE_RUN;
+            positional.insert(positional.end(), args.begin() + i + 1, args.end());
+            break;
+        } else if (arg == "--watch") {
+            opts.mode = MODE_WATCH;
+        } else if (arg == "--interp") {
+            opts.mode = MODE_INTERP;
+        } else if (startsWith(arg, "--tier-threshold=")) {
+            // 0 is allowed, and never compiles anything
+            char *end;
+            opts.tierThreshold = strtoul(arg.c_str() + 17, &end, 10);
+            if (! isdigit((unsigned char) arg[17]) || *end != '\0') {
+                error = "expected a number of calls after --tier-threshold=";
+                return false;
+            }
+        } else if (arg == "--tier-stats") {
+            opts.tierStats = true;
+        } else if (arg == "-ftime-report") {
+            opts.timeReport = true;
+        } else if (startsWith(arg, "--trace=")) {
+            opts.tracePath = arg.substr(8);
+        } else if (arg == "--stats") {
+            opts.statsPath = "-";
+        } else if (startsWith(arg, "--stats=")) {
+            opts.statsPath = arg.substr(8);
+        } else if (arg == "-g") {
+            opts.debugInfo = 2;
+        } else if (arg == "-gline-tables-only") {
+            opts.debugInfo = 1;
+        } else if (arg == "-g0") {
+            opts.debugInfo = 0;
+        } else if (arg == "-fprofile-generate") {
+            opts.profileGenerate = "cppl.profile";
+        } else if (startsWith(arg, "-fprofile-generate=")) {
+            opts.profileGenerate = arg.substr(19);
+        } else if (startsWith(arg, "-fprofile-use=")) {
+            opts.profileUse = arg.substr(14);
+        } else if (startsWith(arg, "-finstrument=")) {
+            if (arg != "-finstrument=profile") {
+                error = "unknown instrumentation " + arg.substr(13);
+                return false;
+            }
+            opts.instrument = true;
+        } else if (arg == "-fspecialize") {
+            opts.specialize = 1;
+        } else if (arg == "-fno-specialize") {
+            opts.specialize = 0;
+        } else if (startsWith(arg, "--symbol-ordering-file=")) {
+            opts.symbolOrderingFile = arg.substr(23);
+        } else if (startsWith(arg, "-Rpass=")) {
+            opts.remarksPassed = arg.substr(7);
+        } else if (startsWith(arg, "-Rpass-missed=")) {
+            opts.remarksMissed = arg.substr(14);
+        } else if (startsWith(arg, "-Rpass-analysis=")) {
+            opts.remarksAnalysis = arg.substr(16);
+        } else if (arg == "-Rpass-summary") {
+            opts.remarksSummary = true;
+        } else if (arg == "-fsave-optimization-record") {
+            opts.saveOptimizationRecord = true;
+        } else if (startsWith(arg, "-fsave-optimization-record=")) {
+            opts.saveOptimizationRecord = true;
+            opts.optimizationRecord = arg.substr(27);
+        } else if (startsWith(arg, "--cache-dir=")) {
+            opts.cacheDir = arg.substr(12);
+        } else if (startsWith(arg, "--cache-size=")) {
+            opts.cacheSize = strtoull(arg.c_str() + 13, NULL, 10) * 1024 * 1024;
+        } else if (arg == "--cache-stats") {
+            opts.mode = MODE_CACHE_STATS;
+        } else if (startsWith(arg, "--server=")) {
+            opts.mode = MODE_SERVER;
+            opts.socketPath = arg.substr(9);
+        } else if (startsWith(arg, "--connect=")) {
+            opts.mode = MODE_CLIENT;
+            opts.socketPath = arg.substr(10);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            error = "unknown option " + arg;
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (opts.cacheDir.empty() && getenv("CPPL_CACHE_DIR") != NULL) {
+        opts.cacheDir = getenv("CPPL_CACHE_DIR");
+    }
+
+    switch (opts.mode) {
+    case MODE_COMPILE:
+    case MODE_CLIENT: {
+        // Every output may have been given its own path by --emit
+        bool needOutput = false, havePaths = false;
+        for (auto &output : opts.emit) {
+            (output.path.empty() ? needOutput : havePaths) = true;
+        }
+
+        if (! haveOutput && needOutput) {
+            if (positional.size() < 2) {
+                error = "expected an input and an output file";
+                return false;
+            }
+            opts.output = positional.back();
+            positional.pop_back();
+        }
+
+        opts.outputIsDir = ! opts.lto && ! opts.output.empty() &&
+            (opts.output.back() == '/' || isDirectory(opts.output));
+        if (positional.empty() || (! opts.lto && ! opts.outputIsDir && positional.size() != 1)) {
+            error = "expected one input per output file, or an output directory";
+            return false;
+        }
+        if (opts.outputIsDir && havePaths) {
+            error = "--emit paths can't be used with an output directory";
+            return false;
+        }
+        if (opts.outputIsDir && ! opts.optimizationRecord.empty()) {
+            error = "-fsave-optimization-record=<file> can't be used with an output directory";
+            return false;
+        }
+        if (opts.outputIsDir) {
+            // Outputs are named after their inputs, so inputs of the same
+            // name in different directories would overwrite each other
+            std::set<std::string> outputs;
+            for (auto &input : positional) {
+                auto output = batchOutput(opts, input);
+                if (! outputs.insert(output).second) {
+                    error = "more than one input would be compiled to " + output;
+                    return false;
+                }
+            }
+        }
+        // Both lower functions into separate objects and link them together
+        if (! opts.incrementalDir.empty() || opts.stream) {
+            std::string flag = opts.stream ? "--stream" : "--incremental";
+            bool cpplInputs = true;
+            for (auto &input : positional) {
+                if (input.size() < 5 || input.compare(input.size() - 5, 5, ".cppl") != 0) cpplInputs = false;
+            }
+            if (opts.stream && ! opts.incrementalDir.empty()) {
+                error = "--stream and --incremental can't be used together";
+                return false;
+            }
+            if (opts.lto || ! cpplInputs || opts.emit.size() != 1 || opts.emit[0].kind != EMIT_OBJ) {
+                error = flag + " only compiles cppl sources to objects, without --lto";
+                return false;
+            }
+            if (opts.debugInfo != 0 || ! opts.profileGenerate.empty()) {
+                error = flag + " can't be used with -g or -fprofile-generate";
+                return false;
+            }
+            if (wantsRemarks(opts)) {
+                error = flag + " can't be used with -Rpass or -fsave-optimization-record";
+                return false;
+            }
+        }
+        break;
+    }
+    case MODE_WATCH:
+        if (! haveOutput && positional.size() == 2) {
+            opts.output = positional.back();
+            positional.pop_back();
+        }
+        if (positional.size() != 1 || ! isDirectory(positional[0]) || opts.output.empty()) {
+            error = "expected a directory to watch and an output directory";
+            return false;
+        }
+        if (opts.lto || opts.stream || opts.emit.size() != 1 || ! opts.emit[0].path.empty()) {
+            error = "--watch writes one output per source, without --lto or --stream";
+            return false;
+        }
+        if (! opts.optimizationRecord.empty()) {
+            error = "-fsave-optimization-record=<file> can't be used with --watch";
+            return false;
+        }
+        if (! opts.incrementalDir.empty() &&
+            (opts.emit[0].kind != EMIT_OBJ || opts.debugInfo != 0 || ! opts.profileGenerate.empty())) {
+            error = "--incremental only compiles to objects, without -g or -fprofile-generate";
+            return false;
+        }
+        break;
+    case MODE_RUN:
+    case MODE_INTERP:
+        if (positional.empty() || (opts.mode == MODE_INTERP && positional.size() != 1)) {
+            error = "expected a file to run";
+            return false;
+        }
+        if (opts.instrument) {
+            error = "-finstrument=profile needs the program to be linked with libcpplrt";
+            return false;
+        }
+        break;
+    case MODE_SERVER:
+        if (! positional.empty()) {
+            error = "the server does not take any files";
+            return false;
+        }
+        break;
+    case MODE_CACHE_STATS:
+        if (opts.cacheDir.empty()) {
+            error = "no cache directory given";
+            return false;
+        }
+        break;
+    }
+
+    opts.inputs = positional;
+    return true;
+}
+
+void usage(std::ostream &os, const char *argv0) {
+    os << "Usage: " << argv0 << " [options] <FileName> <Output>\n"
+       << "       " << argv0 << " [options] --lto <FileName>... <Output>\n"
+       << "       " << argv0 << " [options] -j <n> <FileName>... -o <OutputDir>/\n"
+       << "       " << argv0 << " [options] --watch <Dir> -o <OutputDir>/\n"
+       << "       " << argv0 << " [options] --run <FileName> [args...]\n"
+       << "       " << argv0 << " [options] --interp <FileName>\n"
+       << "       " << argv0 << " --server=<Socket>\n"
+       << "Compiles the file given by <FileName>\n"
+       << "\n"
+       << "Options:\n"
+       << "  -O<n>      Optimization level, 0 to 3 (default 0)\n"
+       << "  -o <path>  Output file, or a directory to put the output for each input in\n"
+       << "  -j <n>     Compile up to n inputs at once when writing to a directory\n"
+       << "  --codegen-threads=<n>\n"
+       << "             Split each object into up to n partitions, which are lowered in\n"
+       << "             parallel and combined with ld -r (assembly is not split)\n"
+       << "  --incremental=<dir>\n"
+       << "             Keep the code of each function in a database in <dir>, and only\n"
+       << "             generate and lower the functions which have changed. Functions\n"
+       << "             are optimized one at a time, so none are inlined into another\n"
+       << "  --stream[=pipeline]\n"
+       << "             Generate and lower a few functions at a time, freeing each once\n"
+       << "             it is done, so that memory use doesn't grow with the input.\n"
+       << "             With =pipeline, parsing runs on a thread of its own\n"
+       << "  --emit=<kind>[=<path>],...\n"
+       << "             Write each kind of output (obj, asm, llvm-ir or bc) from one\n"
+       << "             compile. Outputs without a path are written to <Output>,\n"
+       << "             with its extension replaced if there is more than one\n"
+       << "  --emit-bc  Write LLVM bitcode rather than an object file\n"
+       << "  --lto      Link every input (.cppl, .bc or .ll) into one program,\n"
+       << "             internalize everything but main and optimize it as a whole\n"
+       << "  --watch    Compile every .cppl file under <Dir> into the same place under\n"
+       << "             <OutputDir>, then recompile each file whenever it changes,\n"
+       << "             printing the time each rebuild takes. Unless -g,\n"
+       << "             -fprofile-generate or --incremental is given, objects are built\n"
+       << "             with an incremental database in <OutputDir>/.cppl-incremental\n"
+       << "  --run      JIT-compile <FileName> in-process and run its main function,\n"
+       << "             passing it the remaining arguments\n"
+       << "  --interp   Interpret <FileName>, JIT-compiling functions once they are hot\n"
+       << "  --tier-threshold=<n>\n"
+       << "             Calls before --interp compiles a function (default 1000,\n"
+       << "             0 never compiles)\n"
+       << "  --tier-stats\n"
+       << "             Report interpreter load/run times and promoted functions\n"
+       << "  -ftime-report\n"
+       << "             Print the time spent in each phase of the compiler, and in\n"
+       << "             each LLVM pass (except when compiled by a --server)\n"
+       << "  --trace=<file>\n"
+       << "             Write Chrome trace event JSON of the compiler phases, and the\n"
+       << "             codegen and backend of each function, to <file>\n"
+       << "  --stats[=<file>]\n"
+       << "             Write JSON of the peak RSS of each phase, the memory held by the\n"
+       << "             AST, things, scopes and interned strings, and the IR size of\n"
+       << "             each function, to <file> (default stderr). Phases which run\n"
+       << "             at once (-j, --codegen-threads) share their peaks\n"
+       << "  -g         Emit DWARF debug info: line tables, functions, types and variables\n"
+       << "  -gline-tables-only\n"
+       << "             Emit only the debug info needed to map code to functions and lines\n"
+       << "  -fprofile-generate[=<file>]\n"
+       << "             Count the branches taken and functions entered by the program,\n"
+       << "             appending the counts to <file> at exit (default cppl.profile)\n"
+       << "  -fprofile-use=<file>\n"
+       << "             Optimize for the counts in <file>. Counts of functions which\n"
+       << "             have changed since they were recorded are ignored\n"
+       << "  -finstrument=profile\n"
+       << "             Count the calls and cycles of every function, writing a report to\n"
+       << "             cppl-instrument.txt at exit. Link the object with libcpplrt\n"
+       << "  -fspecialize, -fno-specialize\n"
+       << "             Clone functions for the integer and boolean literals they are\n"
+       << "             called with, folding the code the literals decide (default on\n"
+       << "             at -O2 and above)\n"
+       << "  --symbol-ordering-file=<file>\n"
+       << "             Put each function in a section of its own, and lay out the\n"
+       << "             functions named in <file> (one per line) first, in order. Pass\n"
+       << "             the same file to the linker to order them across objects\n"
+       << "  -Rpass=<regex>, -Rpass-missed=<regex>, -Rpass-analysis=<regex>\n"
+       << "             Print the optimizations done, missed, or analyzed by the LLVM\n"
+       << "             passes matching <regex> (e.g. inline, loop-vectorize), at the\n"
+       << "             cppl lines they concern\n"
+       << "  -Rpass-summary\n"
+       << "             Print the calls inlined and not inlined, and the loops vectorized\n"
+       << "             and not vectorized, in each function\n"
+       << "  -fsave-optimization-record[=<file>]\n"
+       << "             Write every remark to <file> (default <Output>.opt.yaml), as\n"
+       << "             YAML, or JSON if <file> ends in .json\n"
+       << "  --cache-dir=<dir>\n"
+       << "             Reuse outputs of identical earlier compiles from <dir>, and\n"
+       << "             store new ones there (default $CPPL_CACHE_DIR, if set)\n"
+       << "  --cache-size=<MB>\n"
+       << "             Evict least recently used outputs beyond this size (default 1024)\n"
+       << "  --cache-stats\n"
+       << "             Report the hits, misses and size of the cache\n"
+       << "  --server=<Socket>\n"
+       << "             Serve compile requests on a unix socket, keeping LLVM warm\n"
+       << "  --connect=<Socket>\n"
+       << "             Send this compile to the server listening on <Socket>,\n"
+       << "             compiling locally if there is none\n";
+}
@@ -0,0 +1,148 @@
+//
+//  options.h
+//  cppl
+//
+//  Command line handling, shared by the cppl executable and the compile
+//  server (which receives the command lines of its clients).
+//
+
+#ifndef __cppl__options__
+#define __cppl__options__
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+enum DriverMode {
+    MODE_COMPILE,
+    MODE_RUN,
+    MODE_INTERP,
+    MODE_SERVER,
+    MODE_CLIENT,
+    MODE_CACHE_STATS,
+    MODE_WATCH
+};
+
+// The kinds of output --emit can write
+enum EmitKind {
+    EMIT_OBJ,
+    EMIT_ASM,
+    EMIT_LLVM_IR,
+    EMIT_BC
+};
+
+struct EmitOutput {
+    EmitKind kind;
+    // Empty to derive the path from the output file
+    std::string path;
+};
+
+struct Options {
+    DriverMode mode = MODE_COMPILE;
+
+    unsigned optLevel = 0;
+    bool lto = false;
+
+    // --emit=<kind>[=<path>],... and --emit-bc
+    std::vector<EmitOutput> emit = { { EMIT_OBJ, "" } };
+
+    // --interp
+    unsigned tierThreshold = 1000;
+    bool tierStats = false;
+
+    // -ftime-report and --trace=<file>
+    bool timeReport = false;
+    std::string tracePath;
+
+    // --stats[=<file>], where "-" is stderr
+    std::string statsPath;
+
+    // -g and -gline-tables-only, as a DebugLevel
+    unsigned debugInfo = 0;
+
+    // -fprofile-generate[=<file>] and -fprofile-use=<file>
+    std::string profileGenerate;
+    std::string profileUse;
+
+    // -finstrument=profile
+    bool instrument = false;
+
+    // -fspecialize and -fno-specialize; by default on at -O2 and above.
+    // See wantsSpecialize.
+    int specialize = -1;
+
+    // --symbol-ordering-file=<file>: the functions to lay out first, in
+    // order, one name per line
+    std::string symbolOrderingFile;
+
+    // -Rpass=<regex>, -Rpass-missed=<regex> and -Rpass-analysis=<regex>:
+    // print the optimization remarks of the passes whose names match
+    std::string remarksPassed;
+    std::string remarksMissed;
+    std::string remarksAnalysis;
+    // -Rpass-summary
+    bool remarksSummary = false;
+    // -fsave-optimization-record[=<file>]; see optimizationRecordPath
+    bool saveOptimizationRecord = false;
+    std::string optimizationRecord;
+
+    // --server and --connect
+    std::string socketPath;
+
+    // The object cache is used when cacheDir is set, by --cache-dir or
+    // the CPPL_CACHE_DIR environment variable
+    std::string cacheDir;
+    uint64_t cacheSize = 1024 * 1024 * 1024;
+
+    // The files to compile. In MODE_RUN, these are the file to run followed
+    // by the arguments to pass to it.
+    std::vector<std::string> inputs;
+    std::string output;
+
+    // When the output is a directory (-o dir/), each input is compiled
+    // separately into it, using jobs worker threads
+    bool outputIsDir = false;
+    unsigned jobs = 1;
+
+    // --codegen-threads: lower each object in this many partitions at once
+    unsigned codegenThreads = 1;
+
+    // --incremental=<dir>: reuse the code of unchanged functions from the
+    // database in this directory
+    std::string incrementalDir;
+
+    // --stream[=pipeline]
+    bool stream = false;
+    bool streamPipeline = false;
+};
+
+// Whether the compile collects LLVM's optimization remarks
+bool wantsRemarks(const Options &opts);
+
+// Whether functions are specialized on the constants they are called with
+bool wantsSpecialize(const Options &opts);
+
+// Where -fsave-optimization-record writes: the given file, or the first
+// output with its extension replaced by .opt.yaml
+std::string optimizationRecordPath(const Options &opts);
+
+// Parse the arguments (not including argv[0]) into opts.
+// Returns false and sets error if they are invalid.
+bool parseArgs(const std::vector<std::string> &args, Options &opts, std::string &error);
+
+void usage(std::ostream &os, const char *argv0);
+
+// The extension of files of an --emit kind, such as "o"
+const char *emitExtension(EmitKind kind);
+
+// The outputs of opts with every path filled in. If there is only one, and
+// it has no path, it is written to opts.output; otherwise outputs without a
+// path are written to opts.output with their own extension.
+std::vector<EmitOutput> emitOutputs(const Options &opts);
+
+// The path of the output for input in the output directory of opts, named
+// after the input with the extension of its output kind
+std::string batchOutput(const Options &opts, const std::string &input);
+
+#endif /* defined(__cppl__options__) */
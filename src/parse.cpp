@@ -37,7 +37,7 @@ Argument parseArgument(Lexer *lex) {
 }
 
 FunctionProto parseFunctionProto(Lexer *lex) {
-    lex->expect(TOKEN_FN);
+    auto loc = lex->expect(TOKEN_FN).loc;
     auto name = lex->expect(TOKEN_IDENT).data.ident;
     lex->expect(TOKEN_LPAREN);
 
@@ -59,7 +59,9 @@ FunctionProto parseFunctionProto(Lexer *lex) {
         returnType = parseType(lex);
     }
 
-    return FunctionProto(name, arguments, returnType);
+    auto proto = FunctionProto(name, arguments, returnType);
+    proto.loc = loc;
+    return proto;
 }
 
 std::vector<std::unique_ptr<Expr>> parseCallArgs(Lexer *lex) {
@@ -90,7 +92,14 @@ std::vector<std::unique_ptr<Expr>> parseCallArgs(Lexer *lex) {
 std::unique_ptr<Item> parseItem(Lexer *lex) {
     auto firstType = lex->peek().type;
     switch (firstType) {
+    case TOKEN_PUB:
+    case TOKEN_COLD:
     case TOKEN_FN: {
+        bool exported = firstType == TOKEN_PUB;
+        if (exported) lex->eat();
+        bool cold = lex->peek().type == TOKEN_COLD;
+        if (cold) lex->eat();
+
         auto proto = parseFunctionProto(lex);
 
         lex->expect(TOKEN_LBRACE);
@@ -98,18 +107,29 @@ std::unique_ptr<Item> parseItem(Lexer *lex) {
         auto body = parseStmts(lex);
         lex->expect(TOKEN_RBRACE);
 
-        return std::make_unique<FunctionItem>(proto, std::move(body));
+        return std::make_unique<FunctionItem>(proto, std::move(body), exported, cold);
     } break;
 
     case TOKEN_FFI: {
         lex->eat();
+        auto purity = PURITY_NONE;
+        if (lex->peek().type == TOKEN_PURE) {
+            lex->eat();
+            purity = PURITY_PURE;
+        } else if (lex->peek().type == TOKEN_CONST) {
+            lex->eat();
+            purity = PURITY_CONST;
+        }
+        bool cold = lex->peek().type == TOKEN_COLD;
+        if (cold) lex->eat();
+
         firstType = lex->peek().type;
         switch (firstType) {
         case TOKEN_FN: {
             auto proto = parseFunctionProto(lex);
             lex->expect(TOKEN_SEMI);
 
-            return std::make_unique<FFIFunctionItem>(proto);
+            return std::make_unique<FFIFunctionItem>(proto, purity, cold);
         } break;
 
         default: {
@@ -149,7 +169,7 @@ std::unique_ptr<Item> parseItem(Lexer *lex) {
     };
 }
 
-std::unique_ptr<Stmt> parseStmt(Lexer *lex) {
+static std::unique_ptr<Stmt> parseStmtKind(Lexer *lex) {
     auto firstType = lex->peek().type;
     if (firstType == TOKEN_LET) { // TODO: Don't require the let in the future (it'll only take 1 token more lookahead)
         lex->eat();
@@ -178,6 +198,13 @@ std::unique_ptr<Stmt> parseStmt(Lexer *lex) {
     }
 }
 
+std::unique_ptr<Stmt> parseStmt(Lexer *lex) {
+    auto loc = lex->peek().loc;
+    auto stmt = parseStmtKind(lex);
+    stmt->loc = loc;
+    return stmt;
+}
+
 std::vector<Branch> parseIf(Lexer *lex) {
     lex->expect(TOKEN_IF);
     auto cond = parseExpr(lex);
@@ -209,7 +236,7 @@ std::vector<Branch> parseIf(Lexer *lex) {
     }
 }
 
-std::unique_ptr<Expr> parseExprVal(Lexer *lex) {
+static std::unique_ptr<Expr> parseExprValKind(Lexer *lex) {
     auto tokType = lex->peek().type;
 
     switch (tokType) {
@@ -273,13 +300,22 @@ std::unique_ptr<Expr> parseExprVal(Lexer *lex) {
     }
 }
 
+std::unique_ptr<Expr> parseExprVal(Lexer *lex) {
+    auto loc = lex->peek().loc;
+    auto expr = parseExprValKind(lex);
+    expr->loc = loc;
+    return expr;
+}
+
 std::unique_ptr<Expr> parseExprAccess(Lexer *lex) {
+    auto loc = lex->peek().loc;
     auto expr = parseExprVal(lex);
     for (;;) {
         switch (lex->peek().type) {
         case TOKEN_LPAREN: {
             auto args = parseCallArgs(lex);
             expr = std::make_unique<CallExpr>(std::move(expr), std::move(args));
+            expr->loc = loc;
         } continue;
         case TOKEN_DOT: {
             lex->eat();
@@ -287,8 +323,10 @@ std::unique_ptr<Expr> parseExprAccess(Lexer *lex) {
             if (lex->peek().type == TOKEN_LPAREN) {
                 auto args = parseCallArgs(lex);
                 expr = std::make_unique<MthdCallExpr>(std::move(expr), id, std::move(args));
+                expr->loc = loc;
             } else {
                 expr = std::make_unique<MemberExpr>(std::move(expr), id);
+                expr->loc = loc;
             }
         } continue;
         default: break;
@@ -299,6 +337,7 @@ std::unique_ptr<Expr> parseExprAccess(Lexer *lex) {
 }
 
 std::unique_ptr<Expr> parseExprTdm(Lexer *lex) {
+    auto loc = lex->peek().loc;
     auto expr = parseExprAccess(lex);
     for (;;) {
         switch (lex->peek().type) {
@@ -306,16 +345,19 @@ std::unique_ptr<Expr> parseExprTdm(Lexer *lex) {
             lex->eat();
             auto rhs = parseExprAccess(lex);
             expr = std::make_unique<InfixExpr>(OPERATION_TIMES, std::move(expr), std::move(rhs));
+            expr->loc = loc;
         } continue;
         case TOKEN_DIVIDE: {
             lex->eat();
             auto rhs = parseExprAccess(lex);
             expr = std::make_unique<InfixExpr>(OPERATION_DIVIDE, std::move(expr), std::move(rhs));
+            expr->loc = loc;
         } continue;
         case TOKEN_MODULO: {
             lex->eat();
             auto rhs = parseExprAccess(lex);
             expr = std::make_unique<InfixExpr>(OPERATION_MODULO, std::move(expr), std::move(rhs));
+            expr->loc = loc;
         } continue;
         default: break;
         }
@@ -325,18 +367,21 @@ std::unique_ptr<Expr> parseExprTdm(Lexer *lex) {
 }
 
 std::unique_ptr<Expr> parseExprPm(Lexer *lex) {
+    auto loc = lex->peek().loc;
     auto expr = parseExprTdm(lex);
     for (;;) {
         switch (lex->peek().type) {
         case TOKEN_PLUS: {
             lex->eat();
-            auto rhs = parseExprAccess(lex);
+            auto rhs = parseExprTdm(lex);
             expr = std::make_unique<InfixExpr>(OPERATION_PLUS, std::move(expr), std::move(rhs));
+            expr->loc = loc;
         } continue;
-        case TOKEN_DIVIDE: {
+        case TOKEN_MINUS: {
             lex->eat();
-            auto rhs = parseExprAccess(lex);
+            auto rhs = parseExprTdm(lex);
             expr = std::make_unique<InfixExpr>(OPERATION_MINUS, std::move(expr), std::move(rhs));
+            expr->loc = loc;
         } continue;
         default: break;
         }
@@ -1,7 +1,14 @@
 #include "prgm.h"
 #include "gen.h"
+#include "instrument.h"
+#include "profile.h"
+#include "timing.h"
 
+#include <cstring>
+
+#include <llvm/ADT/Triple.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Support/Host.h>
 
 // TODO(michael): When namespaces become a thing, these primitives should have
 // a type which
@@ -21,28 +28,9 @@ struct PrimTypeThing : public TypeThing {
     }
 };
 
-struct VarThing : public ValueThing {
-    Program &prgm;
-    llvm::Value *ptr;
-    TypeThing *type;
-
-    VarThing(Program &prgm, llvm::Value *ptr, TypeThing *type) : prgm(prgm), ptr(ptr), type(type) {};
-
-    ValueThing *asValue() { return this; }
-
-    llvm::Value *llValue() {
-        return prgm.builder.CreateLoad(ptr);
-    }
-
-    TypeThing *typeOf() {
-        return type;
-    }
-
-    void print(llvm::raw_ostream &os) {
-        os << "VarThing(" << *ptr << "): ";
-        type->print(os);
-    }
-};
+llvm::Value *VarThing::llValue() {
+    return prgm.builder.CreateLoad(ptr);
+}
 
 // Initialize the builtin object with a bunch or primitive types
 void Builtin::init(Program &p) {
@@ -67,7 +55,9 @@ void Builtin::init(Program &p) {
 }
 
 
-llvm::Function *llFromProto(Program &prgm, FunctionProto *proto) {
+// Functions which are not exported are only visible to this module. When
+// they are only called directly they can use the fast calling convention.
+llvm::Function *llFromProto(Program &prgm, FunctionProto *proto, bool exported) {
     // std::cout << "** Building function " << proto->name << "\n";
     // Building the function prototype
 
@@ -78,12 +68,27 @@ llvm::Function *llFromProto(Program &prgm, FunctionProto *proto) {
     auto ft = llvm::FunctionType::get(prgm.getType(prgm.globalScope, proto->returnType)->llType(),
                                       arg_types, false);
 
-    auto fn = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, proto->name.data, prgm.module);
+    exported = exported || prgm.options.exportAll || strcmp(proto->name.data, "main") == 0;
+    bool local = ! exported && ! prgm.options.hidePrivate;
+    auto linkage = local ? llvm::Function::InternalLinkage : llvm::Function::ExternalLinkage;
+    auto fn = llvm::Function::Create(ft, linkage, proto->name.data, prgm.module);
+    if (! exported && prgm.options.hidePrivate) {
+        fn->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    }
 
     if (fn->getName() != proto->name.data) {
         assert(false && "Function Redefinition");
     }
 
+    if (! exported && prgm.addressTaken.count(proto->name) == 0) {
+        fn->setCallingConv(llvm::CallingConv::Fast);
+    }
+
+    auto effects = prgm.effects.find(proto->name);
+    if (effects != prgm.effects.end()) {
+        addEffectAttributes(fn, effects->second);
+    }
+
     // Set argument names
     unsigned idx = 0;
     for (auto ai = fn->arg_begin(); idx != proto->arguments.size(); ++ai, ++idx) {
@@ -94,50 +99,83 @@ llvm::Function *llFromProto(Program &prgm, FunctionProto *proto) {
     return fn;
 }
 
+// Cold functions (see effects.h and profile.h) go in .text.unlikely, away
+// from the hot code. With a symbol ordering file, every function has a
+// section of its own, so that the linker can put them in order.
+static void placeFunction(Program &prgm, llvm::Function *fn) {
+    static bool elf = llvm::Triple(llvm::sys::getDefaultTargetTriple()).isOSBinFormatELF();
+    if (! elf) return;
+
+    if (fn->hasFnAttribute(llvm::Attribute::Cold)) {
+        fn->setSection(".text.unlikely." + fn->getName().str());
+    } else if (prgm.options.symbolOrder) {
+        fn->setSection(".text." + fn->getName().str());
+    }
+}
+
 struct FunctionThing : ValueThing {
     Program &prgm;
     FunctionProto *proto;
     std::vector<std::unique_ptr<Stmt>> *body;
+    bool exported;
 
     llvm::Function *fn = NULL;
 
-    FunctionThing(Program &prgm, FunctionProto *proto, std::vector<std::unique_ptr<Stmt>> *body) : prgm(prgm), proto(proto), body(body) {};
+    FunctionThing(Program &prgm, FunctionProto *proto, std::vector<std::unique_ptr<Stmt>> *body, bool exported)
+        : prgm(prgm), proto(proto), body(body), exported(exported) {};
 
     ValueThing *asValue() { return this; }
 
     llvm::Value *llValue() {
         if (fn == NULL) {
-            fn = llFromProto(prgm, proto);
+            fn = llFromProto(prgm, proto, exported);
+            prgm.declared.push_back(&fn);
         }
 
         return fn;
     }
 
     void finalize() {
+        // Only declared so far (see Program::declareFunction)
+        if (body == NULL) return;
+
+        TimeScope scope("codegen", proto->name.data);
         llValue(); // Ensure that fn is set
 
+        // Its code is already in the incremental database
+        if (prgm.bodiesElsewhere.count(proto->name) != 0) return;
+
         // Set up program state to be pointing to this function
-        prgm.fn = fn;
+        prgm.beginFunction(fn);
         prgm.scope = prgm.mkScope(prgm.globalScope);
+        if (prgm.debug) prgm.debug->beginFunction(fn, *proto);
 
-        auto bb = llvm::BasicBlock::Create(prgm.context, "entry", fn);
-        prgm.builder.SetInsertPoint(bb);
+        profileFunction(prgm, *proto, *body);
+        instrumentEntry(prgm, *proto);
+        placeFunction(prgm, fn);
 
         // TODO(michael): Fix up the scope
         unsigned idx = 0;
         for (auto ai = fn->arg_begin(); idx != proto->arguments.size(); ++ai, ++idx) {
             // Allocate room for the argument
-            auto alloca = prgm.builder.CreateAlloca(ai->getType());
+            auto alloca = prgm.frameSlot(ai->getType());
             prgm.builder.CreateStore(ai, alloca);
 
             // Add the argument to the scope
-            prgm.scope->addThing(proto->arguments[idx].name, prgm.thing<VarThing>(alloca, (TypeThing *)NULL));
+            auto type = prgm.getType(prgm.globalScope, proto->arguments[idx].type);
+            prgm.scope->addThing(proto->arguments[idx].name, prgm.thing<VarThing>(alloca, type));
+            if (prgm.debug) {
+                auto &arg = proto->arguments[idx];
+                prgm.debug->declare(alloca, arg.name, arg.type, proto->loc, idx + 1);
+            }
         }
 
         for (auto &stmt : *body) {
             genStmt(prgm, *stmt);
         }
+        prgm.builder.SetCurrentDebugLocation(llvm::DebugLoc());
 
+        TimeScope verifyScope("verify", proto->name.data);
         llvm::verifyFunction(*fn);
     }
 
@@ -145,6 +183,10 @@ struct FunctionThing : ValueThing {
         assert(false && "Unimplemented!");
     }
 
+    TypeThing *returnType() {
+        return prgm.getType(prgm.globalScope, proto->returnType);
+    }
+
     void print(llvm::raw_ostream &os) {
         os << "FunctionThing";
     }
@@ -162,7 +204,9 @@ struct FFIFunctionThing : ValueThing {
 
     llvm::Value *llValue() {
         if (fn == NULL) {
-            fn = llFromProto(prgm, proto);
+            // Always the C ABI, as these are defined elsewhere
+            fn = llFromProto(prgm, proto, true);
+            prgm.declared.push_back(&fn);
         }
 
         return fn;
@@ -172,6 +216,10 @@ struct FFIFunctionThing : ValueThing {
         assert(false && "Unimplemented!");
     };
 
+    TypeThing *returnType() {
+        return prgm.getType(prgm.globalScope, proto->returnType);
+    }
+
     void print(llvm::raw_ostream &os) {
         os << "FFIFunctionThing";
     }
@@ -204,7 +252,7 @@ void Program::addItem(Item &item) {
         Program &prgm;
 
         virtual void visit(FunctionItem *item) {
-            auto fthing = prgm.thing<FunctionThing>(&item->proto, &item->body);
+            auto fthing = prgm.thing<FunctionThing>(&item->proto, &item->body, item->exported);
 
             prgm.globalScope->addThing(item->proto.name, fthing);
         };
@@ -228,13 +276,111 @@ void Program::addItem(Item &item) {
     item.accept(visitor);
 }
 
+void Program::beginFunction(llvm::Function *function) {
+    fn = function;
+    lastSlot = NULL;
+    freeSlots.clear();
+    blockSlots.clear();
+
+    auto bb = llvm::BasicBlock::Create(context, "entry", fn);
+    builder.SetInsertPoint(bb);
+}
+
+llvm::AllocaInst *Program::frameSlot(llvm::Type *type, const char *name) {
+    llvm::AllocaInst *slot = NULL;
+    // A freed slot is dead until its next lifetime start, which is only
+    // emitted inside a block
+    if (! blockSlots.empty()) {
+        for (auto free = freeSlots.begin(); free != freeSlots.end(); ++free) {
+            if ((*free)->getAllocatedType() == type) {
+                slot = *free;
+                freeSlots.erase(free);
+                break;
+            }
+        }
+    }
+
+    if (slot == NULL) {
+        // The slots go in order at the start of the entry block
+        slot = new llvm::AllocaInst(type, name);
+        if (lastSlot != NULL) {
+            slot->insertAfter(lastSlot);
+        } else {
+            auto &entry = fn->getEntryBlock();
+            entry.getInstList().insert(entry.begin(), slot);
+        }
+        lastSlot = slot;
+    }
+
+    if (! blockSlots.empty()) {
+        builder.CreateLifetimeStart(slot);
+        blockSlots.back().push_back(slot);
+    }
+    return slot;
+}
+
+void Program::beginBlockScope() {
+    scope = mkScope(scope);
+    blockSlots.emplace_back();
+}
+
+void Program::endBlockScope() {
+    // Nothing can follow a return
+    bool reachable = builder.GetInsertBlock()->getTerminator() == NULL;
+    for (auto slot : blockSlots.back()) {
+        if (reachable) builder.CreateLifetimeEnd(slot);
+        if (options.debugInfo != DEBUG_FULL) freeSlots.push_back(slot);
+    }
+    blockSlots.pop_back();
+    scope = scope->parent;
+}
+
 void Program::addItems(std::vector<std::unique_ptr<Item>> &items) {
+    // Instrumented functions write their counters
+    effects = inferEffects(items, ! options.profileGenerate.empty() || options.instrument);
+    addressTaken = addressTakenFunctions(items);
+
     for (auto &item : items) {
         addItem(*item);
     }
 }
 
+void Program::declareFunction(const FunctionProto &proto, bool exported) {
+    protos.push_back(proto);
+    auto fthing = thing<FunctionThing>(&protos.back(), (std::vector<std::unique_ptr<Stmt>> *)NULL, exported);
+
+    globalScope->addThing(proto.name, fthing);
+}
+
+void Program::defineFunction(FunctionItem &item) {
+    auto fthing = dynamic_cast<FunctionThing *>(globalScope->thing(item.proto.name));
+    assert(fthing != NULL && fthing->body == NULL);
+
+    // The scopes and variables of the body are only needed while it is generated
+    auto thingCount = things.size();
+    auto scopeCount = scopes.size();
+
+    fthing->body = &item.body;
+    fthing->finalize();
+    fthing->body = NULL;
+
+    things.resize(thingCount);
+    scopes.resize(scopeCount);
+    scope = NULL;
+}
+
+void Program::forgetFunctions() {
+    for (auto fn : declared) {
+        *fn = NULL;
+    }
+    declared.clear();
+}
+
 void Program::finalize() {
+    if (options.debugInfo != DEBUG_NONE) {
+        debug = std::make_unique<DebugInfo>(*this, options.sourcePath, options.debugInfo);
+    }
+
     // Finalize all the things!
     // This is done like this rather than with an iterator because
     // the things vector may be appended to during the finalize method
@@ -242,4 +388,11 @@ void Program::finalize() {
         // std::cout << "finalizing: " << &*things[i] << "\n";
         things[i]->finalize();
     }
+
+    if (! options.profileGenerate.empty()) {
+        emitProfileWriter(*this);
+    }
+    if (debug) {
+        debug->finalize();
+    }
 }
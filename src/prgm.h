@@ -10,8 +10,13 @@
 #define __cppl__prgm__
 
 #include "ast.h"
+#include "debuginfo.h"
+#include "effects.h"
 
+#include <deque>
+#include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -28,6 +33,9 @@ struct TypeThing;
 struct ValueThing;
 
 struct Thing {
+    COUNT_ALLOCATIONS(ALLOC_THINGS)
+
+    virtual ~Thing() {}
     virtual ValueThing *asValue() { return NULL; }
     virtual TypeThing *asType() { return NULL; }
 
@@ -42,11 +50,16 @@ struct TypeThing : public virtual Thing {
 struct ValueThing : public virtual Thing {
     virtual llvm::Value *llValue() = 0;
     virtual TypeThing *typeOf() = 0;
+    // The type of what calling the value returns, if it is a function
+    virtual TypeThing *returnType() { return NULL; }
 };
 
 struct Scope {
+    COUNT_ALLOCATIONS(ALLOC_SCOPES)
+
     Scope *parent;
-    std::unordered_map<istr, Thing *> things;
+    std::unordered_map<istr, Thing *, std::hash<istr>, std::equal_to<istr>,
+                       CountingAllocator<std::pair<const istr, Thing *>, ALLOC_SCOPES>> things;
 
     explicit Scope(Scope *parent) : parent(parent) {}
 
@@ -70,6 +83,54 @@ struct Scope {
 };
 
 struct Program;
+struct ProfileData;
+
+// Settings from the command line which change the generated code
+struct CodegenOptions {
+    // -fprofile-generate: the file the program appends its counts to
+    std::string profileGenerate;
+    // -fprofile-use
+    std::shared_ptr<const ProfileData> profile;
+    // Give every function external linkage and the C calling convention,
+    // as if it were declared `pub`, so that it can be called from outside
+    bool exportAll = false;
+    // -g and -gline-tables-only, and the file the debug info refers to
+    DebugLevel debugInfo = DEBUG_NONE;
+    std::string sourcePath = "<input>";
+    // -finstrument=profile
+    bool instrument = false;
+    // -fspecialize
+    bool specialize = false;
+    // --symbol-ordering-file
+    std::shared_ptr<const std::vector<std::string>> symbolOrder;
+    // Private functions are hidden rather than internal, as they are lowered
+    // into separate objects (--incremental and --stream) and only made local
+    // when those are linked
+    bool hidePrivate = false;
+};
+
+// A variable stored in a stack slot, which is loaded from every time it is used
+struct VarThing : public ValueThing {
+    Program &prgm;
+    llvm::Value *ptr;
+    TypeThing *type;
+
+    VarThing(Program &prgm, llvm::Value *ptr, TypeThing *type) : prgm(prgm), ptr(ptr), type(type) {};
+
+    ValueThing *asValue() { return this; }
+
+    llvm::Value *llValue();
+
+    TypeThing *typeOf() {
+        return type;
+    }
+
+    void print(llvm::raw_ostream &os) {
+        os << "VarThing(" << *ptr << "): ";
+        type->print(os);
+    }
+};
+
 struct Builtin {
     Builtin() {};
 
@@ -96,18 +157,58 @@ struct Program {
     llvm::LLVMContext &context;
     llvm::Module *module;
 
+    CodegenOptions options;
+    // Where warnings about the program, such as stale profiles, are written
+    std::ostream *diag = &std::cerr;
+
     // The current state of the code generator
     Scope *scope = NULL;
     llvm::Function *fn = NULL;
     llvm::IRBuilder<> builder;
 
+    // The stack slots of the current function (see frameSlot)
+    llvm::AllocaInst *lastSlot = NULL;
+    std::vector<llvm::AllocaInst *> freeSlots;
+    std::vector<std::vector<llvm::AllocaInst *>> blockSlots;
+
+    // The profile counters of the current function, for -fprofile-generate,
+    // or its counts, for -fprofile-use (see profile.h)
+    llvm::GlobalVariable *counters = NULL;
+    const std::vector<uint64_t> *counts = NULL;
+    unsigned nextCounter = 0;
+
+    struct ProfiledFunction {
+        std::string name;
+        uint64_t hash;
+        llvm::GlobalVariable *counters;
+        unsigned size;
+    };
+    std::vector<ProfiledFunction> profiled;
+
+    // What each function may do when called, inferred by addItems
+    std::unordered_map<istr, FunctionEffects> effects;
+    // Functions which may be called indirectly, and so need the C calling convention
+    std::unordered_set<istr> addressTaken;
+
+    // Functions which are only declared, as their code is reused from the
+    // incremental database
+    std::unordered_set<istr> bodiesElsewhere;
+
+    // The prototypes given to declareFunction, and every function declared
+    // in the module since the last forgetFunctions
+    std::deque<FunctionProto> protos;
+    std::vector<llvm::Function **> declared;
+
+    // Set up by finalize when generating debug info
+    std::unique_ptr<DebugInfo> debug;
+
     // The program is responsible for maintaining the lifetimes of scopes and things.
     // The vectors below hold unique_ptrs which will free the memory for the scopes
     // and things which have been allocated when the Program is freed.
     std::vector<std::unique_ptr<Thing>> things;
     std::vector<std::unique_ptr<Scope>> scopes;
 
-    Program(llvm::LLVMContext &context = llvm::getGlobalContext())
+    explicit Program(llvm::LLVMContext &context)
         : context(context),
           module(new llvm::Module("cppi_module", context)),
           builder(llvm::IRBuilder<>(context)) {
@@ -156,9 +257,30 @@ struct Program {
         return thing->asType();
     }
 
+    // Allocate a stack slot in the entry block of the current function, so
+    // that mem2reg can promote it and the frame has a fixed size. Inside a
+    // block scope, the slot is only live from here to the end of the block,
+    // and may be reused by a later block (unless -g, which needs a slot per
+    // variable). Slots outside of any block have no lifetime markers, so
+    // they are live for the whole function and never reuse a freed slot.
+    llvm::AllocaInst *frameSlot(llvm::Type *type, const char *name = "");
+    void beginFunction(llvm::Function *function);
+    void beginBlockScope();
+    void endBlockScope();
+
     void addItem(Item &item);
     void addItems(std::vector<std::unique_ptr<Item>> &items);
 
+    // For --stream (see stream.h), which frees each function's AST once it
+    // has been generated: declare a function before its body has been
+    // parsed, and generate its body
+    void declareFunction(const FunctionProto &proto, bool exported);
+    void defineFunction(FunctionItem &item);
+
+    // Drop every function declaration the things hold, so that the module
+    // can be emptied. They are declared again when next used.
+    void forgetFunctions();
+
     void finalize();
 };
 
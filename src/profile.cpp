@@ -0,0 +1,267 @@
+#include "profile.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+bool ProfileData::load(const std::string &path, std::string &error) {
+    std::ifstream in(path);
+    if (! in) {
+        error = "could not open profile " + path;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        uint64_t hash;
+        size_t size;
+        if (! (fields >> name >> hash >> size)) {
+            error = "malformed profile " + path;
+            return false;
+        }
+
+        // Lines for the same version of a function come from separate runs, and add up
+        auto &total = counts[std::make_pair(name, hash)];
+        total.resize(size);
+        for (auto &count : total) {
+            uint64_t value;
+            if (! (fields >> value)) {
+                error = "malformed profile " + path;
+                return false;
+            }
+            count += value;
+        }
+        names.insert(name);
+    }
+
+    for (auto &entry : counts) {
+        if (! entry.second.empty()) maxEntry = std::max(maxEntry, entry.second[0]);
+    }
+    return true;
+}
+
+const std::vector<uint64_t> *ProfileData::lookup(const std::string &name, uint64_t hash,
+                                                 size_t counters, bool &stale) const {
+    auto found = counts.find(std::make_pair(name, hash));
+    if (found == counts.end() || found->second.size() != counters) {
+        stale = names.count(name) != 0;
+        return NULL;
+    }
+
+    stale = false;
+    return &found->second;
+}
+
+// FNV-1a over the kinds of the nodes in a function body. Names and literal
+// values are left out, as they don't change the shape of the function.
+class StructuralHasher : public ExprVisitor, public StmtVisitor {
+public:
+    uint64_t hash = 14695981039346656037ULL;
+    unsigned branches = 0;
+
+    void mix(uint64_t value) {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    }
+
+    void body(std::vector<std::unique_ptr<Stmt>> &stmts) {
+        mix(stmts.size());
+        for (auto &stmt : stmts) {
+            stmt->accept(*this);
+        }
+    }
+
+    void args(std::vector<std::unique_ptr<Expr>> &exprs) {
+        mix(exprs.size());
+        for (auto &expr : exprs) {
+            expr->accept(*this);
+        }
+    }
+
+    virtual void visit(StringExpr *) { mix(1); }
+    virtual void visit(IntExpr *) { mix(2); }
+    virtual void visit(BoolExpr *) { mix(3); }
+    virtual void visit(MkExpr *expr) {
+        mix(4);
+        args(expr->fields);
+    }
+    virtual void visit(CallExpr *expr) {
+        mix(5);
+        expr->callee->accept(*this);
+        args(expr->args);
+    }
+    virtual void visit(MthdCallExpr *expr) {
+        mix(6);
+        expr->object->accept(*this);
+        args(expr->args);
+    }
+    virtual void visit(MemberExpr *expr) {
+        mix(7);
+        expr->object->accept(*this);
+    }
+    virtual void visit(IdentExpr *) { mix(8); }
+    virtual void visit(InfixExpr *expr) {
+        mix(9);
+        mix(expr->op);
+        expr->lhs->accept(*this);
+        expr->rhs->accept(*this);
+    }
+    virtual void visit(IfExpr *expr) {
+        mix(10);
+        mix(expr->branches.size());
+        for (auto &branch : expr->branches) {
+            if (branch.cond != NULL) {
+                branches++;
+                branch.cond->accept(*this);
+            }
+            body(branch.body);
+        }
+    }
+
+    virtual void visit(DeclarationStmt *stmt) {
+        mix(11);
+        stmt->value->accept(*this);
+    }
+    virtual void visit(ExprStmt *stmt) {
+        mix(12);
+        stmt->expr->accept(*this);
+    }
+    virtual void visit(ReturnStmt *stmt) {
+        mix(13);
+        if (stmt->value != nullptr) stmt->value->accept(*this);
+    }
+    virtual void visit(EmptyStmt *) { mix(14); }
+};
+
+uint64_t structuralHash(std::vector<std::unique_ptr<Stmt>> &body, unsigned &branches) {
+    StructuralHasher hasher;
+    hasher.body(body);
+    branches = hasher.branches;
+    return hasher.hash;
+}
+
+void profileFunction(Program &prgm, FunctionProto &proto, std::vector<std::unique_ptr<Stmt>> &body) {
+    prgm.counters = NULL;
+    prgm.counts = NULL;
+    prgm.nextCounter = 1; // The entry count comes first
+
+    if (prgm.options.profileGenerate.empty() && ! prgm.options.profile) return;
+
+    unsigned branches;
+    auto hash = structuralHash(body, branches);
+    unsigned size = 1 + 2 * branches;
+
+    if (! prgm.options.profileGenerate.empty()) {
+        auto i64 = llvm::Type::getInt64Ty(prgm.context);
+        auto type = llvm::ArrayType::get(i64, size);
+        prgm.counters = new llvm::GlobalVariable(*prgm.module, type, false,
+                                                 llvm::GlobalValue::InternalLinkage,
+                                                 llvm::ConstantAggregateZero::get(type),
+                                                 std::string("__cppl_prof_") + proto.name.data);
+        prgm.profiled.push_back({ proto.name.data, hash, prgm.counters, size });
+        profileEdge(prgm, 0);
+    }
+
+    if (prgm.options.profile) {
+        bool stale;
+        prgm.counts = prgm.options.profile->lookup(proto.name.data, hash, size, stale);
+        if (stale) {
+            *prgm.diag << "cppl: warning: " << proto.name.data
+                      << " has changed since it was profiled, ignoring its profile\n";
+        }
+
+        if (prgm.counts != NULL) {
+            auto entry = (*prgm.counts)[0];
+            if (entry == 0) {
+                // Never called while profiling
+                prgm.fn->addFnAttr(llvm::Attribute::Cold);
+                prgm.fn->addFnAttr(llvm::Attribute::OptimizeForSize);
+            } else if (entry * 100 >= prgm.options.profile->maxEntry) {
+                // Within a factor of 100 of the most called function
+                prgm.fn->addFnAttr(llvm::Attribute::InlineHint);
+            }
+        }
+    }
+}
+
+unsigned profileBranch(Program &prgm) {
+    auto counter = prgm.nextCounter;
+    prgm.nextCounter += 2;
+    return counter;
+}
+
+void profileEdge(Program &prgm, unsigned counter) {
+    if (prgm.counters == NULL) return;
+
+    auto ptr = prgm.builder.CreateConstInBoundsGEP2_32(prgm.counters, 0, counter);
+    auto count = prgm.builder.CreateLoad(ptr, "profCount");
+    auto one = llvm::ConstantInt::get(llvm::Type::getInt64Ty(prgm.context), 1);
+    prgm.builder.CreateStore(prgm.builder.CreateAdd(count, one), ptr);
+}
+
+llvm::MDNode *profileWeights(Program &prgm, unsigned counter) {
+    if (prgm.counts == NULL) return NULL;
+
+    uint64_t taken = (*prgm.counts)[counter];
+    uint64_t notTaken = (*prgm.counts)[counter + 1];
+
+    // Weights are 32 bits, so scale large counts down. Adding one keeps an
+    // edge which was never taken from being treated as impossible.
+    uint64_t scale = std::max(taken, notTaken) / UINT32_MAX + 1;
+    llvm::MDBuilder md(prgm.context);
+    return md.createBranchWeights(taken / scale + 1, notTaken / scale + 1);
+}
+
+void emitProfileWriter(Program &prgm) {
+    if (prgm.profiled.empty()) return;
+
+    auto &context = prgm.context;
+    auto module = prgm.module;
+    auto voidTy = llvm::Type::getVoidTy(context);
+    auto i8p = llvm::Type::getInt8PtrTy(context);
+    auto i32 = llvm::Type::getInt32Ty(context);
+
+    auto fopen = module->getOrInsertFunction("fopen", llvm::FunctionType::get(i8p, { i8p, i8p }, false));
+    auto fputs = module->getOrInsertFunction("fputs", llvm::FunctionType::get(i32, { i8p, i8p }, false));
+    auto fprintf = module->getOrInsertFunction("fprintf", llvm::FunctionType::get(i32, { i8p, i8p }, true));
+    auto fclose = module->getOrInsertFunction("fclose", llvm::FunctionType::get(i32, { i8p }, false));
+
+    // Each module writes its own functions, from a destructor, so that this
+    // works the same for objects and for --run
+    auto fn = llvm::Function::Create(llvm::FunctionType::get(voidTy, false),
+                                     llvm::GlobalValue::InternalLinkage,
+                                     "__cppl_profile_write", module);
+    auto entry = llvm::BasicBlock::Create(context, "entry", fn);
+    auto write = llvm::BasicBlock::Create(context, "write", fn);
+    auto done = llvm::BasicBlock::Create(context, "done", fn);
+
+    llvm::IRBuilder<> builder(entry);
+    auto file = builder.CreateCall(fopen, { builder.CreateGlobalStringPtr(prgm.options.profileGenerate),
+                                             builder.CreateGlobalStringPtr("a") });
+    builder.CreateCondBr(builder.CreateIsNull(file), done, write);
+
+    builder.SetInsertPoint(write);
+    auto countFormat = builder.CreateGlobalStringPtr(" %llu");
+    for (auto &profiled : prgm.profiled) {
+        std::ostringstream header;
+        header << profiled.name << " " << profiled.hash << " " << profiled.size;
+        builder.CreateCall(fputs, { builder.CreateGlobalStringPtr(header.str()), file });
+
+        for (unsigned i=0; i<profiled.size; i++) {
+            auto count = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(profiled.counters, 0, i));
+            builder.CreateCall(fprintf, { file, countFormat, count });
+        }
+        builder.CreateCall(fputs, { builder.CreateGlobalStringPtr("\n"), file });
+    }
+    builder.CreateCall(fclose, file);
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(done);
+    builder.CreateRetVoid();
+
+    llvm::appendToGlobalDtors(*module, fn, 0);
+}
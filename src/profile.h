@@ -0,0 +1,62 @@
+//
+//  profile.h
+//  cppl
+//
+//  Profile guided optimization. -fprofile-generate gives every function a
+//  table of counters: one for its entry, and one for each edge out of each
+//  conditional branch, in the order genIf visits them. The counts are
+//  appended to the profile file at exit, one line per function:
+//
+//      <name> <structural hash> <number of counters> <counts>...
+//
+//  -fprofile-use sums the lines for each function, and turns them into
+//  branch weights and hot/cold function attributes.
+//
+
+#ifndef __cppl__profile__
+#define __cppl__profile__
+
+#include "prgm.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct ProfileData {
+    // Keyed by function name and structural hash, so that the counts of
+    // an older version of a function are never used
+    std::map<std::pair<std::string, uint64_t>, std::vector<uint64_t>> counts;
+    std::set<std::string> names;
+
+    // The largest entry count of any function
+    uint64_t maxEntry = 0;
+
+    // Returns false and sets error if the file can't be read
+    bool load(const std::string &path, std::string &error);
+
+    // The counts recorded for the function, or NULL if there are none.
+    // Sets stale if there are counts, but not for this version of it.
+    const std::vector<uint64_t> *lookup(const std::string &name, uint64_t hash, size_t counters, bool &stale) const;
+};
+
+// A hash of the shape of a function body, which changes whenever its
+// branches might, and the number of conditional branches in it
+uint64_t structuralHash(std::vector<std::unique_ptr<Stmt>> &body, unsigned &branches);
+
+// Set up counters or counts for the function being generated, and count its entry
+void profileFunction(Program &prgm, FunctionProto &proto, std::vector<std::unique_ptr<Stmt>> &body);
+
+// Allocate the counters for the two edges of a conditional branch
+unsigned profileBranch(Program &prgm);
+
+// Count an edge out of a branch, if instrumenting
+void profileEdge(Program &prgm, unsigned counter);
+
+// The branch weights for a branch, or NULL if there is no profile for it
+llvm::MDNode *profileWeights(Program &prgm, unsigned counter);
+
+// Add the function which writes every counter to the profile file at exit
+void emitProfileWriter(Program &prgm);
+
+#endif /* defined(__cppl__profile__) */
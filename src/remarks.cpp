@@ -0,0 +1,197 @@
+#include "remarks.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/DiagnosticPrinter.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/raw_ostream.h>
+
+static const char *remarkFlags[] = { "-Rpass", "-Rpass-missed", "-Rpass-analysis" };
+static const char *remarkTags[] = { "Passed", "Missed", "Analysis" };
+
+static void handleDiagnostic(const llvm::DiagnosticInfo &di, void *context) {
+    auto collector = static_cast<RemarkCollector *>(context);
+
+    RemarkKind kind;
+    switch (di.getKind()) {
+    case llvm::DK_OptimizationRemark: kind = REMARK_PASSED; break;
+    case llvm::DK_OptimizationRemarkMissed: kind = REMARK_MISSED; break;
+    case llvm::DK_OptimizationRemarkAnalysis: kind = REMARK_ANALYSIS; break;
+    default: {
+        // Anything else is printed as LLVM would have without a handler
+        std::string msg;
+        llvm::raw_string_ostream os(msg);
+        llvm::DiagnosticPrinterRawOStream printer(os);
+        di.print(printer);
+        os.flush();
+
+        const char *severity = "remark";
+        switch (di.getSeverity()) {
+        case llvm::DS_Error: severity = "error"; break;
+        case llvm::DS_Warning: severity = "warning"; break;
+        case llvm::DS_Note: severity = "note"; break;
+        default: break;
+        }
+        collector->diag << "cppl: " << severity << ": " << msg << "\n";
+        return;
+    }
+    }
+
+    auto &opt = static_cast<const llvm::DiagnosticInfoOptimizationBase &>(di);
+    Remark remark = { kind, opt.getPassName(), opt.getFunction().getName().str(), "", 0, 0, opt.getMsg().str() };
+    if (opt.isLocationAvailable()) {
+        llvm::StringRef file;
+        opt.getLocation(&file, &remark.line, &remark.column);
+        remark.file = file.str();
+    }
+    collector->add(std::move(remark));
+}
+
+RemarkCollector::~RemarkCollector() {
+    if (context != NULL) context->setDiagnosticHandler(nullptr, nullptr);
+}
+
+bool RemarkCollector::init() {
+    const std::string *sources[] = { &opts.remarksPassed, &opts.remarksMissed, &opts.remarksAnalysis };
+    for (int i=0; i<3; i++) {
+        if (sources[i]->empty()) continue;
+
+        patterns[i] = std::make_unique<llvm::Regex>(*sources[i]);
+        std::string error;
+        if (! patterns[i]->isValid(error)) {
+            diag << "cppl: invalid " << remarkFlags[i] << " pattern " << *sources[i] << ": " << error << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void RemarkCollector::install(llvm::LLVMContext &context) {
+    this->context = &context;
+    context.setDiagnosticHandler(handleDiagnostic, this);
+}
+
+void RemarkCollector::add(Remark remark) {
+    auto &pattern = patterns[remark.kind];
+    if (pattern && pattern->match(remark.pass)) {
+        if (remark.file.empty()) {
+            diag << remark.function;
+        } else {
+            diag << remark.file << ":" << remark.line << ":" << remark.column;
+        }
+        diag << ": remark: " << remark.message
+             << " [" << remarkFlags[remark.kind] << "=" << remark.pass << "]\n";
+    }
+
+    if (opts.saveOptimizationRecord || opts.remarksSummary) {
+        remarks.push_back(std::move(remark));
+    }
+}
+
+// Quote str as a single quoted YAML scalar
+static void writeYAMLString(std::ostream &os, const std::string &str) {
+    os << '\'';
+    for (char c : str) {
+        if (c == '\'') os << '\'';
+        os << (c == '\n' ? ' ' : c);
+    }
+    os << '\'';
+}
+
+static void writeYAML(std::ostream &os, const std::vector<Remark> &remarks) {
+    for (auto &remark : remarks) {
+        os << "--- !" << remarkTags[remark.kind] << "\n"
+           << "Pass:            ";
+        writeYAMLString(os, remark.pass);
+        os << "\nFunction:        ";
+        writeYAMLString(os, remark.function);
+        if (! remark.file.empty()) {
+            os << "\nDebugLoc:        { File: ";
+            writeYAMLString(os, remark.file);
+            os << ", Line: " << remark.line << ", Column: " << remark.column << " }";
+        }
+        os << "\nMessage:         ";
+        writeYAMLString(os, remark.message);
+        os << "\n...\n";
+    }
+}
+
+static void writeJSON(std::ostream &os, const std::vector<Remark> &remarks) {
+    os << "[\n";
+    bool first = true;
+    for (auto &remark : remarks) {
+        if (first) first = false; else os << ",\n";
+        os << "{\"kind\":\"" << remarkTags[remark.kind] << "\",\"pass\":";
+        writeJSONString(os, remark.pass);
+        os << ",\"function\":";
+        writeJSONString(os, remark.function);
+        if (! remark.file.empty()) {
+            os << ",\"file\":";
+            writeJSONString(os, remark.file);
+            os << ",\"line\":" << remark.line << ",\"column\":" << remark.column;
+        }
+        os << ",\"message\":";
+        writeJSONString(os, remark.message);
+        os << "}";
+    }
+    os << "\n]\n";
+}
+
+// What the inliner and the loop vectorizer did in each function
+static void writeSummary(std::ostream &os, const std::vector<Remark> &remarks) {
+    struct Counts {
+        unsigned inlined = 0;
+        unsigned notInlined = 0;
+        unsigned vectorized = 0;
+        unsigned notVectorized = 0;
+    };
+
+    std::map<std::string, Counts> functions;
+    for (auto &remark : remarks) {
+        if (remark.pass == "inline") {
+            auto &counts = functions[remark.function];
+            if (remark.kind == REMARK_PASSED) counts.inlined++;
+            if (remark.kind == REMARK_MISSED) counts.notInlined++;
+        } else if (remark.pass == "loop-vectorize") {
+            auto &counts = functions[remark.function];
+            if (remark.kind == REMARK_PASSED) counts.vectorized++;
+            if (remark.kind == REMARK_MISSED) counts.notVectorized++;
+        }
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "%8s %8s %8s %8s  %s\n", "Inlined", "Not", "Vector", "Not", "Function");
+    os << line;
+    for (auto &entry : functions) {
+        auto &counts = entry.second;
+        snprintf(line, sizeof(line), "%8u %8u %8u %8u  %s\n", counts.inlined, counts.notInlined,
+                 counts.vectorized, counts.notVectorized, entry.first.c_str());
+        os << line;
+    }
+}
+
+bool RemarkCollector::finish(std::string &error) {
+    if (opts.remarksSummary) {
+        writeSummary(diag, remarks);
+    }
+
+    if (opts.saveOptimizationRecord) {
+        auto path = optimizationRecordPath(opts);
+        std::ofstream os(path);
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json) {
+            writeJSON(os, remarks);
+        } else {
+            writeYAML(os, remarks);
+        }
+        if (! os) {
+            error = "could not write " + path;
+            return false;
+        }
+    }
+    return true;
+}
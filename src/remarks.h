@@ -0,0 +1,66 @@
+//
+//  remarks.h
+//  cppl
+//
+//  LLVM's optimization remarks (-Rpass, -Rpass-missed, -Rpass-analysis,
+//  -Rpass-summary and -fsave-optimization-record). The passes report what
+//  they did and didn't do through the LLVMContext's diagnostic handler,
+//  which a RemarkCollector takes over for the length of a compile. The
+//  remarks are located using line tables, which the compile generates for
+//  the purpose when -g isn't given (see codegenOptions).
+//
+
+#ifndef __cppl__remarks__
+#define __cppl__remarks__
+
+#include "options.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/Regex.h>
+
+enum RemarkKind {
+    REMARK_PASSED,
+    REMARK_MISSED,
+    REMARK_ANALYSIS
+};
+
+struct Remark {
+    RemarkKind kind;
+    std::string pass;
+    std::string function;
+    std::string file; // Empty if the location is unknown
+    unsigned line;
+    unsigned column;
+    std::string message;
+};
+
+struct RemarkCollector {
+    const Options &opts;
+    std::ostream &diag;
+    std::unique_ptr<llvm::Regex> patterns[3]; // By RemarkKind
+    std::vector<Remark> remarks;
+    llvm::LLVMContext *context = NULL;
+
+    RemarkCollector(const Options &opts, std::ostream &diag) : opts(opts), diag(diag) {}
+    ~RemarkCollector();
+
+    // Compile the -Rpass patterns. Returns false and writes to diag if one
+    // is invalid.
+    bool init();
+
+    // Handle the diagnostics of context until the collector is destroyed
+    void install(llvm::LLVMContext &context);
+
+    void add(Remark remark);
+
+    // Print the summary and write the record, if they were asked for.
+    // Returns false and sets error on failure.
+    bool finish(std::string &error);
+};
+
+#endif /* defined(__cppl__remarks__) */
@@ -0,0 +1,331 @@
+#include "server.h"
+#include "driver.h"
+#include "options.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+// Requests come from whoever can reach the socket, so their sizes are
+// checked before anything is allocated for them
+static const uint32_t maxFrameSize = 1 << 20;
+static const unsigned long maxArguments = 4096;
+
+// Each read of a request times out after this long, so that idle connections
+// can't hold on to every worker
+static const int requestTimeoutSeconds = 10;
+
+static bool writeAll(int fd, const void *data, size_t size) {
+    auto p = (const char *) data;
+    while (size > 0) {
+        auto n = write(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t size) {
+    auto p = (char *) data;
+    while (size > 0) {
+        auto n = read(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeFrame(int fd, const std::string &data) {
+    uint32_t size = data.size();
+    return writeAll(fd, &size, sizeof(size)) && writeAll(fd, data.data(), size);
+}
+
+static bool readFrame(int fd, std::string &data) {
+    uint32_t size;
+    if (! readAll(fd, &size, sizeof(size)) || size > maxFrameSize) return false;
+    data.resize(size);
+    return readAll(fd, &data[0], size);
+}
+
+static bool fillAddress(const std::string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+// Relative paths in a request are relative to the client, not the server
+static std::string resolve(const std::string &cwd, const std::string &path) {
+    if (path.empty() || path[0] == '/') return path;
+    return cwd + "/" + path;
+}
+
+// Parse the argument count of a request, which must be a plain decimal
+// number between 1 and maxArguments
+static bool parseCount(const std::string &frame, unsigned long &count) {
+    if (frame.empty() || frame.size() > 8 || frame.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    count = strtoul(frame.c_str(), NULL, 10);
+    return count >= 1 && count <= maxArguments;
+}
+
+// Compile the request of the client at fd and send it the response
+static void compile(CompilerContext &cc, int fd, const std::string &cwd, const std::vector<std::string> &args) {
+    std::ostringstream diag;
+    int status = 1;
+
+    Options opts;
+    std::string error;
+    if (! parseArgs(args, opts, error)) {
+        diag << "cppl: " << error << "\n";
+    } else if (opts.mode != MODE_COMPILE) {
+        diag << "cppl: the server can only compile files\n";
+    } else {
+        for (auto &input : opts.inputs) {
+            input = resolve(cwd, input);
+        }
+        opts.output = resolve(cwd, opts.output);
+        for (auto &output : opts.emit) {
+            output.path = resolve(cwd, output.path);
+        }
+        opts.cacheDir = resolve(cwd, opts.cacheDir);
+        opts.profileUse = resolve(cwd, opts.profileUse);
+        opts.symbolOrderingFile = resolve(cwd, opts.symbolOrderingFile);
+        opts.incrementalDir = resolve(cwd, opts.incrementalDir);
+        opts.optimizationRecord = resolve(cwd, opts.optimizationRecord);
+        opts.tracePath = resolve(cwd, opts.tracePath);
+        if (opts.statsPath != "-") opts.statsPath = resolve(cwd, opts.statsPath);
+
+        // This is the child, so only this request is timed and measured, and
+        // the reports for the terminal go back with the diagnostics. LLVM's pass timings are left out,
+        // as it only reports them when it is shut down.
+        beginReports(opts, false);
+        status = runJob(cc, opts, diag);
+        if (! writeReports(opts, diag)) status = 1;
+    }
+
+    writeFrame(fd, std::to_string(status)) && writeFrame(fd, diag.str());
+}
+
+static void handle(CompilerContext &cc, int fd) {
+    std::string frame;
+    unsigned long count;
+    if (! readFrame(fd, frame) || ! parseCount(frame, count)) return;
+
+    std::string cwd;
+    if (! readFrame(fd, cwd)) return;
+
+    std::vector<std::string> args(count - 1);
+    for (auto &arg : args) {
+        if (! readFrame(fd, arg)) return;
+    }
+
+    // The front end reports errors in the source with assertions, so the
+    // compile is made in a child process, which a bad source only takes
+    // down with it
+    pid_t pid = fork();
+    if (pid < 0) {
+        writeFrame(fd, "1") && writeFrame(fd, std::string("cppl: fork: ") + strerror(errno) + "\n");
+        return;
+    }
+    if (pid == 0) {
+        compile(cc, fd, cwd, args);
+        _exit(0);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (WIFSIGNALED(status)) {
+        writeFrame(fd, "1") && writeFrame(fd, "cppl: the compiler crashed (signal " +
+                                              std::to_string(WTERMSIG(status)) + ")\n");
+    }
+}
+
+int runServer(const std::string &path, unsigned threads) {
+    sockaddr_un addr;
+    if (! fillAddress(path, addr)) {
+        std::cerr << "cppl: socket path too long: " << path << "\n";
+        return 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("cppl: socket");
+        return 1;
+    }
+
+    unlink(path.c_str());
+    if (bind(listener, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(listener, 128) < 0) {
+        perror("cppl: bind");
+        return 1;
+    }
+
+    // A client going away mid-response shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    // Requests are parsed here, but come with the client's environment (see
+    // runClient), so they must not pick up the server's
+    unsetenv("CPPL_CACHE_DIR");
+
+    // Pay for LLVM initialization once, up front
+    initializeLLVM();
+
+    // Every compile is made in a child forked from a worker, so the
+    // TargetMachines are set up here, before any threads exist, and each
+    // child inherits them warm. Nothing else touches LLVM in this process,
+    // so no worker can hold one of its locks when another forks.
+    CompilerContext cc;
+    for (unsigned optLevel=0; optLevel<=3; optLevel++) {
+        llvm::LLVMContext context;
+        llvm::Module mod("server", context);
+        std::string error;
+        if (! cc.targetMachine(mod, optLevel, error)) {
+            std::cerr << "cppl: " << error << "\n";
+            return 1;
+        }
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::deque<int> pending;
+    bool shutdown = false;
+
+    // Each worker waits on one compile at a time
+    std::vector<std::thread> workers;
+    for (unsigned i=0; i<threads; i++) {
+        workers.emplace_back([&]() {
+            for (;;) {
+                int fd;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    wakeup.wait(guard, [&]() { return shutdown || ! pending.empty(); });
+                    if (pending.empty()) return;
+                    fd = pending.front();
+                    pending.pop_front();
+                }
+
+                handle(cc, fd);
+                close(fd);
+            }
+        });
+    }
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            // A client giving up before it was accepted is its own problem
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
+            // Out of descriptors or memory until some requests finish
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                perror("cppl: accept");
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            perror("cppl: accept");
+            break;
+        }
+
+        struct timeval timeout = { requestTimeoutSeconds, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending.push_back(fd);
+        }
+        wakeup.notify_one();
+    }
+
+    // Let the workers finish the requests they have, and then stop
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        shutdown = true;
+    }
+    wakeup.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    close(listener);
+    return 1;
+}
+
+int runClient(const std::string &path, const std::vector<std::string> &args) {
+    // Forward every argument but the one which brought us here
+    std::vector<std::string> forwarded;
+    bool haveCacheDir = false;
+    for (auto &arg : args) {
+        if (arg.compare(0, 10, "--connect=") != 0) forwarded.push_back(arg);
+        if (arg.compare(0, 12, "--cache-dir=") == 0) haveCacheDir = true;
+    }
+
+    // The server can't see our environment, so pass on what it would read
+    auto cacheDir = getenv("CPPL_CACHE_DIR");
+    if (! haveCacheDir && cacheDir != NULL) {
+        forwarded.push_back(std::string("--cache-dir=") + cacheDir);
+    }
+
+    sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ! fillAddress(path, addr) || connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        if (fd >= 0) close(fd);
+
+        Options opts;
+        std::string error;
+        if (! parseArgs(forwarded, opts, error)) {
+            std::cerr << "cppl: " << error << "\n";
+            return 1;
+        }
+        CompilerContext cc;
+        beginReports(opts, true);
+        int status = runJob(cc, opts, std::cerr);
+        return writeReports(opts, std::cerr) ? status : 1;
+    }
+
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("cppl: getcwd");
+        return 1;
+    }
+
+    bool ok = writeFrame(fd, std::to_string(forwarded.size() + 1)) && writeFrame(fd, cwd);
+    for (auto &arg : forwarded) {
+        ok = ok && writeFrame(fd, arg);
+    }
+
+    std::string status, diag;
+    ok = ok && readFrame(fd, status) && readFrame(fd, diag);
+    close(fd);
+
+    if (! ok) {
+        std::cerr << "cppl: lost connection to the compile server\n";
+        return 1;
+    }
+
+    std::cerr << diag;
+    return std::stoi(status);
+}
@@ -0,0 +1,36 @@
+//
+//  server.h
+//  cppl
+//
+//  A compile server which keeps LLVM initialized and its TargetMachines
+//  warm between compiles, and the thin client which talks to it.
+//
+//  Requests and responses are sent over a unix stream socket as frames of
+//  a 32-bit length followed by that many bytes. A request is a frame
+//  holding the number of strings, followed by a frame per string: the
+//  working directory of the client, then its arguments. The response is a
+//  frame holding the exit status, then a frame of diagnostics. Frames of
+//  more than a megabyte, and requests of more than 4096 strings, are
+//  refused, as are clients which stall for ten seconds mid-request.
+//
+//  Each request is compiled in a child process forked from the server, so
+//  that a source which fails one of the front end's assertions doesn't
+//  take the server down with it.
+//
+
+#ifndef __cppl__server__
+#define __cppl__server__
+
+#include <string>
+#include <vector>
+
+// Listen on the socket at path, handling requests on threads worker
+// threads (0 to use one per hardware thread). Only returns on error.
+int runServer(const std::string &path, unsigned threads);
+
+// Send the arguments to the server listening at path, print its
+// diagnostics, and return its exit status. Falls back to compiling in
+// this process if no server is listening.
+int runClient(const std::string &path, const std::vector<std::string> &args);
+
+#endif /* defined(__cppl__server__) */
@@ -0,0 +1,450 @@
+#include "specialize.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// The largest body, in expressions and statements, which is cloned
+static const unsigned maxCloneSize = 400;
+// A clone must fold a use of a constant for every this many nodes of the body
+static const unsigned nodesPerBenefit = 16;
+// The most clones made of any one function
+static const unsigned maxClonesPerFunction = 8;
+
+// Evaluate an operation on two constants as the generated code would, on
+// unsigned 32 bit integers. Division by zero is left to happen at runtime.
+static bool fold(OperationType op, int lhs, int rhs, int &result) {
+    uint32_t a = lhs;
+    uint32_t b = rhs;
+    switch (op) {
+    case OPERATION_PLUS: result = a + b; return true;
+    case OPERATION_MINUS: result = a - b; return true;
+    case OPERATION_TIMES: result = a * b; return true;
+    case OPERATION_DIVIDE:
+        if (b == 0) return false;
+        result = a / b;
+        return true;
+    case OPERATION_MODULO:
+        if (b == 0) return false;
+        result = a % b;
+        return true;
+    }
+    return false;
+}
+
+// Copies a function body, replacing the names in constants with their
+// values, and folding the operations and ifs which that makes constant
+class Cloner : public ExprVisitor, public StmtVisitor {
+public:
+    const std::unordered_map<istr, Expr *> &constants;
+    std::unique_ptr<Expr> expr;
+    std::unique_ptr<Stmt> stmt;
+
+    Cloner(const std::unordered_map<istr, Expr *> &constants) : constants(constants) {}
+
+    std::unique_ptr<Expr> clone(Expr &from) {
+        from.accept(*this);
+        auto result = std::move(expr);
+        result->loc = from.loc;
+        return result;
+    }
+
+    std::vector<std::unique_ptr<Expr>> args(std::vector<std::unique_ptr<Expr>> &from) {
+        std::vector<std::unique_ptr<Expr>> result;
+        for (auto &arg : from) {
+            result.push_back(clone(*arg));
+        }
+        return result;
+    }
+
+    std::vector<std::unique_ptr<Stmt>> body(std::vector<std::unique_ptr<Stmt>> &from) {
+        std::vector<std::unique_ptr<Stmt>> result;
+        for (auto &s : from) {
+            s->accept(*this);
+            stmt->loc = s->loc;
+            result.push_back(std::move(stmt));
+        }
+        return result;
+    }
+
+    virtual void visit(StringExpr *from) {
+        expr = std::make_unique<StringExpr>(from->value);
+    }
+    virtual void visit(IntExpr *from) {
+        expr = std::make_unique<IntExpr>(from->value);
+    }
+    virtual void visit(BoolExpr *from) {
+        expr = std::make_unique<BoolExpr>(from->value);
+    }
+    virtual void visit(MkExpr *from) {
+        expr = std::make_unique<MkExpr>(from->type, args(from->fields));
+    }
+    virtual void visit(CallExpr *from) {
+        auto callee = clone(*from->callee);
+        expr = std::make_unique<CallExpr>(std::move(callee), args(from->args));
+    }
+    virtual void visit(MthdCallExpr *from) {
+        auto object = clone(*from->object);
+        expr = std::make_unique<MthdCallExpr>(std::move(object), from->symbol, args(from->args));
+    }
+    virtual void visit(MemberExpr *from) {
+        expr = std::make_unique<MemberExpr>(clone(*from->object), from->symbol);
+    }
+    virtual void visit(IdentExpr *from) {
+        auto found = constants.find(from->ident);
+        if (found != constants.end()) {
+            found->second->accept(*this);
+        } else {
+            expr = std::make_unique<IdentExpr>(from->ident);
+        }
+    }
+    virtual void visit(InfixExpr *from) {
+        auto lhs = clone(*from->lhs);
+        auto rhs = clone(*from->rhs);
+
+        auto lhsInt = dynamic_cast<IntExpr *>(lhs.get());
+        auto rhsInt = dynamic_cast<IntExpr *>(rhs.get());
+        int value;
+        if (lhsInt != NULL && rhsInt != NULL && fold(from->op, lhsInt->value, rhsInt->value, value)) {
+            expr = std::make_unique<IntExpr>(value);
+        } else {
+            expr = std::make_unique<InfixExpr>(from->op, std::move(lhs), std::move(rhs));
+        }
+    }
+    virtual void visit(IfExpr *from) {
+        std::vector<Branch> branches;
+        for (auto &branch : from->branches) {
+            if (branch.cond == NULL) {
+                branches.push_back(Branch(nullptr, body(branch.body)));
+                break;
+            }
+
+            auto cond = clone(*branch.cond);
+            if (auto constant = dynamic_cast<BoolExpr *>(cond.get())) {
+                if (! constant->value) continue;
+                // Always taken, so it is the else branch of those before it
+                branches.push_back(Branch(nullptr, body(branch.body)));
+                break;
+            }
+            branches.push_back(Branch(std::move(cond), body(branch.body)));
+        }
+        expr = std::make_unique<IfExpr>(std::move(branches));
+    }
+
+    virtual void visit(DeclarationStmt *from) {
+        stmt = std::make_unique<DeclarationStmt>(from->name, from->type, clone(*from->value));
+    }
+    virtual void visit(ExprStmt *from) {
+        stmt = std::make_unique<ExprStmt>(clone(*from->expr));
+    }
+    virtual void visit(ReturnStmt *from) {
+        stmt = std::make_unique<ReturnStmt>(from->value != nullptr ? clone(*from->value) : nullptr);
+    }
+    virtual void visit(EmptyStmt *) {
+        stmt = std::make_unique<EmptyStmt>();
+    }
+};
+
+// The size of a function body, the names it declares, and how much each of
+// its arguments would fold away if it were constant: a use in an if
+// condition may decide the branch, and an operand of an arithmetic operation
+// may fold it, while any other use may still let a call be specialized.
+class BodySummary : public ExprVisitor, public StmtVisitor {
+public:
+    unsigned size = 0;
+    std::unordered_set<istr> locals;
+    std::unordered_map<istr, unsigned> benefit; // By argument name
+    unsigned condDepth = 0;
+
+    void use(istr name, unsigned weight) {
+        auto found = benefit.find(name);
+        if (found != benefit.end()) {
+            found->second += condDepth > 0 ? 4 : weight;
+        }
+    }
+
+    void body(std::vector<std::unique_ptr<Stmt>> &stmts) {
+        for (auto &stmt : stmts) {
+            size++;
+            stmt->accept(*this);
+        }
+    }
+
+    void args(std::vector<std::unique_ptr<Expr>> &exprs) {
+        for (auto &expr : exprs) {
+            visitExpr(*expr);
+        }
+    }
+
+    void visitExpr(Expr &expr) {
+        size++;
+        expr.accept(*this);
+    }
+
+    virtual void visit(StringExpr *) {}
+    virtual void visit(IntExpr *) {}
+    virtual void visit(BoolExpr *) {}
+    virtual void visit(MkExpr *expr) {
+        args(expr->fields);
+    }
+    virtual void visit(CallExpr *expr) {
+        visitExpr(*expr->callee);
+        args(expr->args);
+    }
+    virtual void visit(MthdCallExpr *expr) {
+        visitExpr(*expr->object);
+        args(expr->args);
+    }
+    virtual void visit(MemberExpr *expr) {
+        visitExpr(*expr->object);
+    }
+    virtual void visit(IdentExpr *expr) {
+        use(expr->ident, 1);
+    }
+    virtual void visit(InfixExpr *expr) {
+        for (auto operand : { expr->lhs.get(), expr->rhs.get() }) {
+            if (auto ident = dynamic_cast<IdentExpr *>(operand)) {
+                size++;
+                use(ident->ident, 2);
+            } else {
+                visitExpr(*operand);
+            }
+        }
+    }
+    virtual void visit(IfExpr *expr) {
+        for (auto &branch : expr->branches) {
+            if (branch.cond != NULL) {
+                condDepth++;
+                visitExpr(*branch.cond);
+                condDepth--;
+            }
+            body(branch.body);
+        }
+    }
+
+    virtual void visit(DeclarationStmt *stmt) {
+        locals.insert(stmt->name);
+        visitExpr(*stmt->value);
+    }
+    virtual void visit(ExprStmt *stmt) {
+        visitExpr(*stmt->expr);
+    }
+    virtual void visit(ReturnStmt *stmt) {
+        if (stmt->value != nullptr) visitExpr(*stmt->value);
+    }
+    virtual void visit(EmptyStmt *) {}
+};
+
+struct Specializer {
+    struct Candidate {
+        FunctionItem *item;
+        unsigned size;
+        // How much each argument folds away, or 0 if it can't be bound
+        // (its type has no literals, or a local shadows it)
+        std::vector<unsigned> benefit;
+        unsigned clones = 0;
+    };
+
+    std::vector<std::unique_ptr<Item>> &items;
+    std::unordered_map<istr, Candidate> candidates;
+    // The clone for each function and the constants bound in it
+    std::unordered_map<std::string, istr> cache;
+    // The function each clone was made from
+    std::unordered_map<istr, istr> origins;
+    unsigned clones = 0;
+    istr i32 = intern("i32");
+    istr boolean = intern("boolean");
+
+    Specializer(std::vector<std::unique_ptr<Item>> &items) : items(items) {
+        for (auto &item : items) {
+            auto fnItem = dynamic_cast<FunctionItem *>(item.get());
+            if (fnItem == NULL) continue;
+
+            BodySummary summary;
+            for (auto &arg : fnItem->proto.arguments) {
+                summary.benefit[arg.name] = 0;
+            }
+            summary.body(fnItem->body);
+
+            Candidate candidate = { fnItem, summary.size, {} };
+            for (auto &arg : fnItem->proto.arguments) {
+                bool literal = arg.type.ident == i32 || arg.type.ident == boolean;
+                bool shadowed = summary.locals.count(arg.name) > 0;
+                candidate.benefit.push_back(literal && ! shadowed ? summary.benefit[arg.name] : 0);
+            }
+            candidates.emplace(fnItem->proto.name, std::move(candidate));
+        }
+    }
+
+    // The clone of callee to call with args, removing the arguments it binds.
+    // Returns false if the call is left as it is.
+    bool specialize(istr caller, istr &callee, std::vector<std::unique_ptr<Expr>> &args) {
+        auto found = candidates.find(callee);
+        if (found == candidates.end()) return false;
+        auto &candidate = found->second;
+        auto &proto = candidate.item->proto;
+        if (args.size() != proto.arguments.size()) return false;
+
+        std::string key(callee.data, callee.length);
+        std::vector<bool> bound;
+        unsigned benefit = 0;
+        for (size_t i=0; i<args.size(); i++) {
+            bool isInt = dynamic_cast<IntExpr *>(args[i].get()) != NULL &&
+                proto.arguments[i].type.ident == i32;
+            bool isBool = dynamic_cast<BoolExpr *>(args[i].get()) != NULL &&
+                proto.arguments[i].type.ident == boolean;
+            bound.push_back(candidate.benefit[i] > 0 && (isInt || isBool));
+            if (! bound.back()) {
+                key += ",_";
+            } else if (isInt) {
+                key += "," + std::to_string(static_cast<IntExpr *>(args[i].get())->value);
+            } else {
+                key += static_cast<BoolExpr *>(args[i].get())->value ? ",true" : ",false";
+            }
+            if (bound.back()) benefit += candidate.benefit[i];
+        }
+        if (benefit == 0) return false;
+
+        auto cached = cache.find(key);
+        if (cached != cache.end()) {
+            callee = cached->second;
+        } else {
+            // A clone calling the function it was made from with other
+            // constants (a counter passed down a recursion) would clone it
+            // again for every level
+            auto origin = origins.find(caller);
+            if (origin != origins.end() && origin->second == callee) return false;
+
+            if (candidate.size > maxCloneSize || candidate.size > benefit * nodesPerBenefit ||
+                candidate.clones >= maxClonesPerFunction) {
+                return false;
+            }
+            callee = makeClone(candidate, args, bound);
+            cache.emplace(key, callee);
+        }
+
+        std::vector<std::unique_ptr<Expr>> rest;
+        for (size_t i=0; i<args.size(); i++) {
+            if (! bound[i]) rest.push_back(std::move(args[i]));
+        }
+        args = std::move(rest);
+        return true;
+    }
+
+    istr makeClone(Candidate &candidate, std::vector<std::unique_ptr<Expr>> &args,
+                   const std::vector<bool> &bound) {
+        auto &from = *candidate.item;
+        // Not a valid identifier, so it can't collide with a function of the program
+        auto name = intern(std::string(from.proto.name.data, from.proto.name.length) +
+                           ".spec." + std::to_string(candidate.clones++));
+        clones++;
+        origins.emplace(name, from.proto.name);
+
+        std::unordered_map<istr, Expr *> constants;
+        std::vector<Argument> arguments;
+        for (size_t i=0; i<args.size(); i++) {
+            if (bound[i]) {
+                constants[from.proto.arguments[i].name] = args[i].get();
+            } else {
+                arguments.push_back(from.proto.arguments[i]);
+            }
+        }
+
+        FunctionProto proto(name, arguments, from.proto.returnType);
+        proto.loc = from.proto.loc;
+        Cloner cloner(constants);
+        items.push_back(std::make_unique<FunctionItem>(proto, cloner.body(from.body), false, from.cold));
+        return name;
+    }
+};
+
+// Specializes the calls made by a function body, to functions which aren't
+// shadowed by its arguments or locals
+class CallRewriter : public ExprVisitor, public StmtVisitor {
+public:
+    Specializer &specializer;
+    istr caller;
+    std::unordered_set<istr> locals;
+
+    CallRewriter(Specializer &specializer, istr caller) : specializer(specializer), caller(caller) {}
+
+    void body(std::vector<std::unique_ptr<Stmt>> &stmts) {
+        for (auto &stmt : stmts) {
+            stmt->accept(*this);
+        }
+    }
+
+    void args(std::vector<std::unique_ptr<Expr>> &exprs) {
+        for (auto &expr : exprs) {
+            expr->accept(*this);
+        }
+    }
+
+    virtual void visit(StringExpr *) {}
+    virtual void visit(IntExpr *) {}
+    virtual void visit(BoolExpr *) {}
+    virtual void visit(MkExpr *expr) {
+        args(expr->fields);
+    }
+    virtual void visit(CallExpr *expr) {
+        expr->callee->accept(*this);
+        args(expr->args);
+
+        auto ident = dynamic_cast<IdentExpr *>(expr->callee.get());
+        if (ident != NULL && locals.count(ident->ident) == 0) {
+            specializer.specialize(caller, ident->ident, expr->args);
+        }
+    }
+    virtual void visit(MthdCallExpr *expr) {
+        expr->object->accept(*this);
+        args(expr->args);
+    }
+    virtual void visit(MemberExpr *expr) {
+        expr->object->accept(*this);
+    }
+    virtual void visit(IdentExpr *) {}
+    virtual void visit(InfixExpr *expr) {
+        expr->lhs->accept(*this);
+        expr->rhs->accept(*this);
+    }
+    virtual void visit(IfExpr *expr) {
+        for (auto &branch : expr->branches) {
+            if (branch.cond != NULL) branch.cond->accept(*this);
+            body(branch.body);
+        }
+    }
+
+    virtual void visit(DeclarationStmt *stmt) {
+        stmt->value->accept(*this);
+    }
+    virtual void visit(ExprStmt *stmt) {
+        stmt->expr->accept(*this);
+    }
+    virtual void visit(ReturnStmt *stmt) {
+        if (stmt->value != nullptr) stmt->value->accept(*this);
+    }
+    virtual void visit(EmptyStmt *) {}
+};
+
+unsigned specializeFunctions(std::vector<std::unique_ptr<Item>> &items) {
+    Specializer specializer(items);
+
+    // Clones are appended as they are made, and are rewritten in turn, as
+    // the constants substituted into them may be passed on to other calls
+    for (size_t i=0; i<items.size(); i++) {
+        auto fnItem = dynamic_cast<FunctionItem *>(items[i].get());
+        if (fnItem == NULL) continue;
+
+        BodySummary summary;
+        summary.body(fnItem->body);
+
+        CallRewriter rewriter(specializer, fnItem->proto.name);
+        rewriter.locals = std::move(summary.locals);
+        for (auto &arg : fnItem->proto.arguments) {
+            rewriter.locals.insert(arg.name);
+        }
+        rewriter.body(fnItem->body);
+    }
+    return specializer.clones;
+}
@@ -0,0 +1,29 @@
+//
+//  specialize.h
+//  cppl
+//
+//  Function specialization on constant arguments. Where a function is called
+//  with integer or boolean literals, it is cloned with those arguments
+//  substituted into its body, and the arithmetic and ifs they decide folded
+//  away, and the call is made to the clone with the remaining arguments.
+//  This runs on the AST before any IR is generated, so it applies where
+//  LLVM won't propagate the constants itself: functions called with
+//  different constants from different places, and recursive functions which
+//  pass the constants on to themselves.
+//
+
+#ifndef __cppl__specialize__
+#define __cppl__specialize__
+
+#include "ast.h"
+
+#include <memory>
+#include <vector>
+
+// Specialize the calls in items, appending the clones to items. Calls
+// passing the same constants to a function share its clone. A clone is
+// only made if the body is small, and the constants are used enough in it
+// to pay for the copy. Returns the number of clones made.
+unsigned specializeFunctions(std::vector<std::unique_ptr<Item>> &items);
+
+#endif /* defined(__cppl__specialize__) */
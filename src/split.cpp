@@ -0,0 +1,318 @@
+#include "split.h"
+#include "driver.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+extern char **environ;
+
+// Call fn with every instruction or global variable which uses value,
+// looking through constant expressions
+template <class F>
+static void forEachUser(const llvm::Value *value, F fn) {
+    for (auto user : value->users()) {
+        if (llvm::isa<llvm::Constant>(user) && ! llvm::isa<llvm::GlobalValue>(user)) {
+            forEachUser(user, fn);
+        } else {
+            fn(user);
+        }
+    }
+}
+
+// Union-find over globals
+struct UnionFind {
+    std::unordered_map<const llvm::GlobalValue *, const llvm::GlobalValue *> parent;
+
+    const llvm::GlobalValue *find(const llvm::GlobalValue *gv) {
+        auto found = parent.find(gv);
+        if (found == parent.end() || found->second == gv) return gv;
+        return found->second = find(found->second);
+    }
+
+    void join(const llvm::GlobalValue *a, const llvm::GlobalValue *b) {
+        a = find(a);
+        b = find(b);
+        if (a != b) parent[b] = a;
+    }
+};
+
+// The global which a use of a global is in: a function, or a variable
+// whose initializer refers to it
+static const llvm::GlobalValue *userGlobal(const llvm::User *user) {
+    if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) return inst->getParent()->getParent();
+    return llvm::dyn_cast<llvm::GlobalVariable>(user);
+}
+
+// The -fprofile-generate writer reads the counters of every function (see
+// profile.cpp). Keeping them together would put every function in one group,
+// so it refers to them across groups instead, as if they weren't local.
+static bool isProfileRead(const llvm::GlobalValue *from, const llvm::GlobalValue *gv) {
+    return from->getName() == "__cppl_profile_write" && gv->getName().startswith("__cppl_prof_");
+}
+
+std::vector<std::vector<llvm::GlobalValue *>> symbolGroups(llvm::Module &mod) {
+    std::vector<llvm::GlobalValue *> globals;
+    for (auto &fn : mod) globals.push_back(&fn);
+    for (auto &var : mod.globals()) globals.push_back(&var);
+
+    // Functions reference each other by symbol, so they can be lowered
+    // separately; variables, which are mostly private string constants and
+    // counters, stay with their users.
+    UnionFind sets;
+    for (auto gv : globals) {
+        // Groups are matched up by name when a module is reloaded
+        if (! gv->hasName()) gv->setName("__cppl_anon");
+
+        forEachUser(gv, [&](const llvm::User *user) {
+            auto from = userGlobal(user);
+            if (from != NULL && (llvm::isa<llvm::GlobalVariable>(gv) || llvm::isa<llvm::GlobalVariable>(from)) &&
+                ! isProfileRead(from, gv)) {
+                sets.join(from, gv);
+            }
+        });
+    }
+
+    std::unordered_map<const llvm::GlobalValue *, size_t> groupOf;
+    std::vector<std::vector<llvm::GlobalValue *>> groups;
+    for (auto gv : globals) {
+        auto found = groupOf.emplace(sets.find(gv), groups.size());
+        if (found.second) groups.emplace_back();
+        groups[found.first->second].push_back(gv);
+    }
+    return groups;
+}
+
+void exposeCrossGroupLocals(const std::vector<std::vector<llvm::GlobalValue *>> &groups,
+                            const std::vector<unsigned> &partitionOf) {
+    std::unordered_map<const llvm::GlobalValue *, unsigned> partitionOfGlobal;
+    for (size_t i=0; i<groups.size(); i++) {
+        for (auto gv : groups[i]) partitionOfGlobal[gv] = partitionOf[i];
+    }
+
+    for (size_t i=0; i<groups.size(); i++) {
+        for (auto gv : groups[i]) {
+            if (! gv->hasLocalLinkage()) continue;
+
+            bool usedElsewhere = false;
+            forEachUser(gv, [&](const llvm::User *user) {
+                auto from = userGlobal(user);
+                if (from != NULL && partitionOfGlobal[from] != partitionOf[i]) usedElsewhere = true;
+            });
+            if (usedElsewhere) {
+                gv->setLinkage(llvm::GlobalValue::ExternalLinkage);
+                gv->setVisibility(llvm::GlobalValue::HiddenVisibility);
+            }
+        }
+    }
+}
+
+// Spread the groups of mod over up to threads partitions, largest first into
+// the lightest, returning the number of partitions
+static unsigned partition(llvm::Module &mod, unsigned threads,
+                          std::unordered_map<std::string, unsigned> &partitionOfName) {
+    auto groups = symbolGroups(mod);
+
+    std::vector<uint64_t> weights;
+    for (auto &group : groups) {
+        uint64_t weight = 0;
+        for (auto gv : group) {
+            weight++;
+            if (auto fn = llvm::dyn_cast<llvm::Function>(gv)) {
+                for (auto &bb : *fn) weight += bb.size();
+            }
+        }
+        weights.push_back(weight);
+    }
+
+    unsigned count = std::min<size_t>(threads, groups.size());
+    if (count <= 1) return 1;
+
+    std::vector<unsigned> order(groups.size());
+    for (unsigned i=0; i<order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return weights[a] > weights[b];
+    });
+
+    std::vector<uint64_t> loads(count, 0);
+    std::vector<unsigned> partitionOf(groups.size());
+    for (auto group : order) {
+        auto lightest = std::min_element(loads.begin(), loads.end()) - loads.begin();
+        partitionOf[group] = lightest;
+        loads[lightest] += weights[group];
+    }
+
+    for (size_t i=0; i<groups.size(); i++) {
+        for (auto gv : groups[i]) partitionOfName[gv->getName().str()] = partitionOf[i];
+    }
+    exposeCrossGroupLocals(groups, partitionOf);
+    return count;
+}
+
+void keepOnly(llvm::Module &mod, std::function<bool(const llvm::GlobalValue &)> keep) {
+    std::vector<llvm::Function *> removed;
+    for (auto &fn : mod) {
+        if (! fn.isDeclaration() && ! keep(fn)) {
+            fn.deleteBody();
+            removed.push_back(&fn);
+        }
+    }
+
+    std::vector<llvm::GlobalVariable *> unused;
+    for (auto &var : mod.globals()) {
+        if (var.isDeclaration() || keep(var)) continue;
+        if (var.use_empty()) {
+            unused.push_back(&var);
+        } else {
+            var.setInitializer(NULL);
+            var.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+    }
+    for (auto var : unused) var->eraseFromParent();
+
+    for (auto fn : removed) {
+        if (fn->use_empty()) fn->eraseFromParent();
+    }
+}
+
+static bool runTool(const std::vector<std::string> &args, std::string &error) {
+    std::vector<char *> argv;
+    for (auto &arg : args) argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(NULL);
+
+    pid_t pid;
+    int status;
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv.data(), environ) != 0 ||
+        waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        error = "could not run " + args[0] + " to combine objects";
+        return false;
+    }
+    return true;
+}
+
+std::string tempPath(const char *suffix) {
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/cppl-part-XXXXXX" + suffix;
+    int fd = mkstemps(&path[0], strlen(suffix));
+    if (fd < 0) return "";
+    close(fd);
+    return path;
+}
+
+bool combineObjects(const std::vector<std::string> &objects, llvm::SmallVectorImpl<char> &buffer,
+                    std::string &error) {
+    const char *ld = getenv("LD");
+    const char *objcopy = getenv("OBJCOPY");
+
+    std::string combined = tempPath(".o");
+    std::vector<std::string> link = { ld ? ld : "ld", "-r", "-o", combined };
+    link.insert(link.end(), objects.begin(), objects.end());
+    bool ok = ! combined.empty() && runTool(link, error) &&
+        runTool({ objcopy ? objcopy : "objcopy", "--localize-hidden", combined }, error);
+
+    if (ok) {
+        std::ifstream in(combined, std::ios::binary);
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        auto data = ss.str();
+        buffer.assign(data.begin(), data.end());
+        ok = ! data.empty();
+        if (! ok) error = "could not read the combined object";
+    }
+
+    if (! combined.empty()) unlink(combined.c_str());
+    return ok;
+}
+
+bool emitObjectParallel(llvm::Module &mod, unsigned optLevel, unsigned threads,
+                        llvm::SmallVectorImpl<char> &buffer, std::string &error) {
+    std::unordered_map<std::string, unsigned> partitionOf;
+    unsigned count;
+    std::string bitcode;
+    {
+        TimeScope scope("split-module");
+        count = partition(mod, threads, partitionOf);
+
+        llvm::raw_string_ostream os(bitcode);
+        emitBitcode(mod, os);
+        os.flush();
+    }
+
+    std::vector<std::string> objects(count), errors(count);
+    auto lower = [&](unsigned part) {
+        TimeScope scope("backend-partition", std::to_string(part));
+
+        // LLVMContexts can't be shared between threads, so each partition
+        // is loaded into its own
+        llvm::LLVMContext context;
+        auto loaded = llvm::parseBitcodeFile(llvm::MemoryBufferRef(bitcode, mod.getModuleIdentifier()), context);
+        if (! loaded) {
+            errors[part] = loaded.getError().message();
+            return;
+        }
+        std::unique_ptr<llvm::Module> partMod(loaded.get());
+        keepOnly(*partMod, [&](const llvm::GlobalValue &gv) {
+            auto found = partitionOf.find(gv.getName().str());
+            return found == partitionOf.end() || found->second == part;
+        });
+
+        auto targetMachine = createTargetMachine(*partMod, optLevel, errors[part]);
+        if (! targetMachine) return;
+
+        objects[part] = tempPath(".o");
+        std::error_code ec;
+        llvm::raw_fd_ostream os(objects[part], ec, llvm::sys::fs::F_None);
+        if (objects[part].empty() || ec) {
+            errors[part] = "could not create a temporary file";
+        } else if (emitFile(*partMod, *targetMachine, os, llvm::TargetMachine::CGFT_ObjectFile)) {
+            errors[part] = "target does not support generation of this file type!";
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i=1; i<count; i++) {
+        workers.emplace_back(lower, i);
+    }
+    lower(0);
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    bool ok = true;
+    for (auto &e : errors) {
+        if (! e.empty()) {
+            error = e;
+            ok = false;
+            break;
+        }
+    }
+
+    if (ok) {
+        TimeScope scope("combine-partitions");
+        ok = combineObjects(objects, buffer, error);
+    }
+
+    for (auto &object : objects) {
+        if (! object.empty()) unlink(object.c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,54 @@
+//
+//  split.h
+//  cppl
+//
+//  Parallel code generation (--codegen-threads). The optimized module is
+//  split into partitions by function, keeping every global variable in the
+//  same partition as the functions which use it. Each partition is lowered
+//  on its own thread, in its own LLVMContext, and the objects are combined
+//  with `ld -r`. Internal functions called across partitions are made
+//  hidden for the link, and local again afterwards with
+//  `objcopy --localize-hidden`.
+//
+//  The partitions only depend on the module and the number of threads, so
+//  the output is the same from run to run.
+//
+
+#ifndef __cppl__split__
+#define __cppl__split__
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Module.h>
+
+// The globals of mod in the groups which have to be lowered together, in
+// module order. Unnamed globals are given names, so that groups can be
+// matched up by name in a copy of the module.
+std::vector<std::vector<llvm::GlobalValue *>> symbolGroups(llvm::Module &mod);
+
+// Give every local which is used from a group in another partition hidden
+// visibility instead, so that the partitions can be linked together
+void exposeCrossGroupLocals(const std::vector<std::vector<llvm::GlobalValue *>> &groups,
+                            const std::vector<unsigned> &partitionOf);
+
+// Turn the definitions in mod for which keep returns false into declarations,
+// or remove them if nothing left refers to them
+void keepOnly(llvm::Module &mod, std::function<bool(const llvm::GlobalValue &)> keep);
+
+// Link objects into one relocatable object in buffer, and make their hidden
+// symbols local. Returns false and sets error on failure.
+bool combineObjects(const std::vector<std::string> &objects, llvm::SmallVectorImpl<char> &buffer,
+                    std::string &error);
+
+// Create an empty temporary file ending in suffix, returning "" on failure
+std::string tempPath(const char *suffix);
+
+// Lower mod into an object in buffer using up to threads partitions.
+// Returns false and sets error on failure.
+bool emitObjectParallel(llvm::Module &mod, unsigned optLevel, unsigned threads,
+                        llvm::SmallVectorImpl<char> &buffer, std::string &error);
+
+#endif /* defined(__cppl__split__) */
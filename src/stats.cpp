@@ -0,0 +1,195 @@
+#include "stats.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+AllocatorCounts allocatorCounts[NUM_ALLOCATORS];
+
+static const char *allocatorNames[NUM_ALLOCATORS] = { "ast", "things", "scopes", "intern" };
+
+bool statsEnabled = false;
+
+struct PhaseStats {
+    unsigned count = 0;
+    int64_t peakRssKb = 0;
+    int64_t bytes[NUM_ALLOCATORS] = {};
+    int64_t blocks[NUM_ALLOCATORS] = {};
+};
+
+struct IRCounts {
+    bool recorded = false;
+    unsigned instructions = 0;
+    unsigned blocks = 0;
+    unsigned allocas = 0;
+};
+
+struct FunctionStats {
+    std::string module;
+    std::string name;
+    IRCounts generated;
+    IRCounts optimized;
+};
+
+static std::mutex statsLock;
+// Phases in the order they first ended, with repeats (one per function
+// chunk, or per input) folded together
+static std::vector<std::pair<std::string, PhaseStats>> phases;
+static std::map<std::pair<std::string, std::string>, FunctionStats> functions;
+
+// The peak RSS of each phase open on this thread, not counting the peak
+// since the high water mark was last reset
+static thread_local std::vector<int64_t> openPhases;
+
+// The kernel's high water mark of the RSS, in KB
+static int64_t rssHighWater() {
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status != NULL) {
+        char line[256];
+        while (fgets(line, sizeof(line), status)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) {
+                fclose(status);
+                return atoll(line + 6);
+            }
+        }
+        fclose(status);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Set the high water mark back to the current RSS. Where this isn't
+// supported the peaks are since the start of the process.
+static void resetRssHighWater() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return;
+    if (write(fd, "5", 1) != 1) {}
+    close(fd);
+}
+
+void enableStats() {
+    statsEnabled = true;
+}
+
+void beginStatsPhase() {
+    if (! openPhases.empty()) {
+        openPhases.back() = std::max(openPhases.back(), rssHighWater());
+    }
+    resetRssHighWater();
+    openPhases.push_back(0);
+}
+
+void endStatsPhase(const char *name) {
+    int64_t peak = std::max(openPhases.back(), rssHighWater());
+    openPhases.pop_back();
+    if (! openPhases.empty()) {
+        openPhases.back() = std::max(openPhases.back(), peak);
+    }
+
+    std::lock_guard<std::mutex> guard(statsLock);
+    auto found = std::find_if(phases.begin(), phases.end(), [&](const std::pair<std::string, PhaseStats> &phase) {
+        return phase.first == name;
+    });
+    if (found == phases.end()) {
+        phases.emplace_back(name, PhaseStats());
+        found = phases.end() - 1;
+    }
+
+    auto &phase = found->second;
+    phase.count++;
+    phase.peakRssKb = std::max(phase.peakRssKb, peak);
+    for (int i=0; i<NUM_ALLOCATORS; i++) {
+        phase.bytes[i] = std::max(phase.bytes[i], allocatorCounts[i].bytes.load());
+        phase.blocks[i] = std::max(phase.blocks[i], allocatorCounts[i].blocks.load());
+    }
+}
+
+void recordIRStats(llvm::Module &mod, const char *stage) {
+    if (! statsEnabled) return;
+
+    std::lock_guard<std::mutex> guard(statsLock);
+    for (auto &fn : mod) {
+        if (fn.isDeclaration()) continue;
+
+        IRCounts counts;
+        counts.recorded = true;
+        for (auto &bb : fn) {
+            counts.blocks++;
+            for (auto &inst : bb) {
+                counts.instructions++;
+                if (llvm::isa<llvm::AllocaInst>(inst)) counts.allocas++;
+            }
+        }
+
+        auto &stats = functions[{ mod.getModuleIdentifier(), fn.getName().str() }];
+        stats.module = mod.getModuleIdentifier();
+        stats.name = fn.getName().str();
+        (strcmp(stage, "optimized") == 0 ? stats.optimized : stats.generated) = counts;
+    }
+}
+
+static void writeIRCounts(std::ostream &os, const char *stage, const IRCounts &counts) {
+    if (! counts.recorded) return;
+    os << ",\"" << stage << "\":{\"instructions\":" << counts.instructions
+       << ",\"blocks\":" << counts.blocks
+       << ",\"allocas\":" << counts.allocas << "}";
+}
+
+bool writeStats(std::ostream &os) {
+    std::lock_guard<std::mutex> guard(statsLock);
+
+    os << "{\"phases\":[\n";
+    bool first = true;
+    for (auto &entry : phases) {
+        auto &phase = entry.second;
+        if (first) first = false; else os << ",\n";
+        os << "{\"name\":";
+        writeJSONString(os, entry.first);
+        os << ",\"count\":" << phase.count << ",\"peakRssKb\":" << phase.peakRssKb << ",\"allocators\":{";
+        for (int i=0; i<NUM_ALLOCATORS; i++) {
+            os << (i == 0 ? "" : ",") << "\"" << allocatorNames[i] << "\":{\"bytes\":" << phase.bytes[i]
+               << ",\"blocks\":" << phase.blocks[i] << "}";
+        }
+        os << "}}";
+    }
+
+    os << "\n],\"allocators\":{\n";
+    for (int i=0; i<NUM_ALLOCATORS; i++) {
+        auto &counts = allocatorCounts[i];
+        os << (i == 0 ? "" : ",\n") << "\"" << allocatorNames[i] << "\":{\"bytes\":" << counts.bytes.load()
+           << ",\"blocks\":" << counts.blocks.load()
+           << ",\"peakBytes\":" << counts.peakBytes.load()
+           << ",\"allocations\":" << counts.allocations.load() << "}";
+    }
+
+    os << "\n},\"functions\":[\n";
+    first = true;
+    for (auto &entry : functions) {
+        auto &fn = entry.second;
+        if (first) first = false; else os << ",\n";
+        os << "{\"module\":";
+        writeJSONString(os, fn.module);
+        os << ",\"name\":";
+        writeJSONString(os, fn.name);
+        writeIRCounts(os, "generated", fn.generated);
+        writeIRCounts(os, "optimized", fn.optimized);
+        os << "}";
+    }
+    os << "\n]}\n";
+
+    return (bool) os;
+}
@@ -0,0 +1,133 @@
+//
+//  stats.h
+//  cppl
+//
+//  Memory and IR size accounting (--stats). The AST, Things, scopes and the
+//  intern pool count every allocation they make, the peak RSS of each phase
+//  of the compiler is recorded by a StatsPhase, and the size of the IR of
+//  each function is recorded before and after it is optimized. The report
+//  is written as JSON.
+//
+
+#ifndef __cppl__stats__
+#define __cppl__stats__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <new>
+
+namespace llvm {
+    class Module;
+}
+
+enum Allocator {
+    ALLOC_AST,
+    ALLOC_THINGS,
+    ALLOC_SCOPES,
+    ALLOC_INTERN,
+    NUM_ALLOCATORS
+};
+
+struct AllocatorCounts {
+    std::atomic<int64_t> bytes;       // Live
+    std::atomic<int64_t> blocks;      // Live
+    std::atomic<int64_t> peakBytes;
+    std::atomic<int64_t> allocations; // Ever made
+};
+
+// Counted whether or not stats are enabled, so that frees always match
+// their allocations. Relaxed atomics are cheap next to the allocations.
+extern AllocatorCounts allocatorCounts[NUM_ALLOCATORS];
+
+inline void countAllocation(Allocator allocator, size_t size) {
+    auto &counts = allocatorCounts[allocator];
+    int64_t bytes = counts.bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    counts.blocks.fetch_add(1, std::memory_order_relaxed);
+    counts.allocations.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t peak = counts.peakBytes.load(std::memory_order_relaxed);
+    while (bytes > peak && ! counts.peakBytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {}
+}
+
+inline void countFree(Allocator allocator, size_t size) {
+    auto &counts = allocatorCounts[allocator];
+    counts.bytes.fetch_sub(size, std::memory_order_relaxed);
+    counts.blocks.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Gives a class (and everything derived from it) an operator new and delete
+// which count under allocator. The class must have a virtual destructor, so
+// that delete is passed the size of the most derived object.
+#define COUNT_ALLOCATIONS(allocator)                                    \
+    static void *operator new(size_t size) {                            \
+        countAllocation(allocator, size);                               \
+        return ::operator new(size);                                    \
+    }                                                                   \
+    static void operator delete(void *ptr, size_t size) {               \
+        countFree(allocator, size);                                     \
+        ::operator delete(ptr);                                         \
+    }
+
+// A std allocator for the containers owned by a counted allocator
+template <class T, Allocator allocator>
+struct CountingAllocator {
+    typedef T value_type;
+
+    template <class U>
+    struct rebind {
+        typedef CountingAllocator<U, allocator> other;
+    };
+
+    CountingAllocator() {}
+    template <class U>
+    CountingAllocator(const CountingAllocator<U, allocator> &) {}
+
+    T *allocate(size_t n) {
+        countAllocation(allocator, n * sizeof(T));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *ptr, size_t n) {
+        countFree(allocator, n * sizeof(T));
+        ::operator delete(ptr);
+    }
+
+    template <class U>
+    bool operator==(const CountingAllocator<U, allocator> &) const { return true; }
+    template <class U>
+    bool operator!=(const CountingAllocator<U, allocator> &) const { return false; }
+};
+
+extern bool statsEnabled;
+
+// Start recording phases and IR sizes. Must be called before any compile starts.
+void enableStats();
+
+void beginStatsPhase();
+void endStatsPhase(const char *name);
+
+// Records the peak RSS over a phase of the compiler, and what the allocators
+// hold at its end. Phases may nest; the peak of a phase includes those of
+// the phases inside it.
+struct StatsPhase {
+    const char *name;
+
+    explicit StatsPhase(const char *name) : name(name) {
+        if (statsEnabled) beginStatsPhase();
+    }
+
+    ~StatsPhase() {
+        if (statsEnabled) endStatsPhase(name);
+    }
+};
+
+// Record the instruction, basic block and alloca counts of each function
+// defined in mod, as of stage ("generated" or "optimized")
+void recordIRStats(llvm::Module &mod, const char *stage);
+
+// Write the report as JSON. Returns false on failure.
+bool writeStats(std::ostream &os);
+
+#endif /* defined(__cppl__stats__) */
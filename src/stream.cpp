@@ -0,0 +1,186 @@
+#include "stream.h"
+#include "lexer.h"
+#include "parse.h"
+#include "split.h"
+#include "stats.h"
+#include "timing.h"
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+// Functions generated into the module before it is lowered and emptied
+static const unsigned CHUNK_FUNCTIONS = 1024;
+
+// Parsed items on their way from the parser thread to code generation. The
+// parser waits when it gets too far ahead, so that the items don't pile up.
+struct ItemQueue {
+    static const size_t CAPACITY = 256;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::unique_ptr<Item>> items;
+    bool done = false;
+
+    void push(std::unique_ptr<Item> item) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]() { return items.size() < CAPACITY; });
+        items.push_back(std::move(item));
+        changed.notify_all();
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+        changed.notify_all();
+    }
+
+    // The next item, or NULL once there are no more
+    std::unique_ptr<Item> pop() {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]() { return ! items.empty() || done; });
+        if (items.empty()) return nullptr;
+
+        auto item = std::move(items.front());
+        items.pop_front();
+        changed.notify_all();
+        return item;
+    }
+};
+
+// Remove everything from the module, whose globals nothing refers to any more
+static void emptyModule(llvm::Module &mod) {
+    for (auto &fn : mod) fn.dropAllReferences();
+    for (auto &var : mod.globals()) var.dropAllReferences();
+
+    while (! mod.empty()) mod.begin()->eraseFromParent();
+    while (! mod.global_empty()) mod.global_begin()->eraseFromParent();
+}
+
+bool compileStreaming(CompilerContext &cc, const Options &opts, llvm::SmallVectorImpl<char> &buffer,
+                      std::ostream &diag) {
+    auto &input = opts.inputs[0];
+
+    CodegenOptions options;
+    if (! codegenOptions(opts, options, diag)) return false;
+    options.hidePrivate = true;
+    options.sourcePath = input;
+
+    llvm::LLVMContext context;
+    Program prgm(context);
+    prgm.options = options;
+    prgm.diag = &diag;
+    std::unique_ptr<llvm::Module> mod(prgm.module);
+    mod->setModuleIdentifier(input);
+
+    // Declare everything, so that functions can be generated before the
+    // ones they call have been parsed. Structs and FFI declarations are
+    // small, and kept whole.
+    std::vector<std::unique_ptr<Item>> declarations;
+    {
+        TimeScope scope("prototypes");
+        StatsPhase phase("prototypes");
+        std::ifstream in(input);
+        if (! in) {
+            diag << "cppl: could not open " << input << "\n";
+            return false;
+        }
+
+        EffectsSummary summary(options.instrument);
+        Lexer lex(&in);
+        while (! lex.eof()) {
+            auto item = parseItem(&lex);
+            summary.add(*item);
+            if (auto fnItem = dynamic_cast<FunctionItem *>(item.get())) {
+                prgm.declareFunction(fnItem->proto, fnItem->exported);
+            } else {
+                prgm.addItem(*item);
+                declarations.push_back(std::move(item));
+            }
+        }
+
+        prgm.effects = summary.solve();
+        prgm.addressTaken = std::move(summary.addressTaken);
+    }
+
+    std::string error;
+    auto targetMachine = cc.targetMachine(*mod, opts.optLevel, error);
+    if (! targetMachine) {
+        diag << "cppl: " << error << "\n";
+        return false;
+    }
+
+    std::vector<std::string> objects;
+    unsigned pending = 0;
+    auto lowerChunk = [&]() {
+        TimeScope scope("lower-chunk");
+        StatsPhase phase("lower-chunk");
+        optimizeModule(*mod, *targetMachine, opts.optLevel);
+
+        auto path = tempPath(".o");
+        objects.push_back(path);
+        std::error_code ec;
+        llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::F_None);
+        bool ok = ! path.empty() && ! ec &&
+            ! emitFile(*mod, *targetMachine, os, llvm::TargetMachine::CGFT_ObjectFile);
+
+        prgm.forgetFunctions();
+        emptyModule(*mod);
+        pending = 0;
+        return ok;
+    };
+
+    // Read the items again, generating each function as soon as it's parsed
+    std::ifstream in(input);
+    Lexer lex(&in);
+    ItemQueue queue;
+    std::thread parser;
+    if (opts.streamPipeline) {
+        parser = std::thread([&]() {
+            while (! lex.eof()) {
+                queue.push(parseItem(&lex));
+            }
+            queue.finish();
+        });
+    }
+
+    bool ok = true;
+    for (;;) {
+        std::unique_ptr<Item> item;
+        if (opts.streamPipeline) {
+            item = queue.pop();
+        } else if (! lex.eof()) {
+            item = parseItem(&lex);
+        }
+        if (! item) break;
+
+        auto fnItem = dynamic_cast<FunctionItem *>(item.get());
+        if (fnItem == NULL || ! ok) continue;
+
+        prgm.defineFunction(*fnItem);
+        if (++pending == CHUNK_FUNCTIONS) ok = lowerChunk();
+    }
+    if (parser.joinable()) parser.join();
+    // A program without functions still gets an object
+    if (ok && (pending > 0 || objects.empty())) ok = lowerChunk();
+
+    if (! ok) {
+        error = "could not lower the program";
+    } else {
+        TimeScope scope("combine-chunks");
+        ok = combineObjects(objects, buffer, error);
+    }
+    if (! ok) diag << "cppl: " << error << "\n";
+
+    for (auto &object : objects) {
+        if (! object.empty()) unlink(object.c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,31 @@
+//
+//  stream.h
+//  cppl
+//
+//  Streaming compilation (--stream). A first pass over the source declares
+//  every function from its prototype, and summarizes its calls for effect
+//  inference, without keeping its body. The second pass parses the items
+//  again one at a time and generates each function as soon as it has been
+//  parsed, freeing its AST and temporaries right after. Every so many
+//  functions, the module is lowered to an object and emptied, and the
+//  objects are linked with `ld -r` at the end (see split.h).
+//
+//  What stays in memory is one prototype per function and the functions of
+//  the current chunk, rather than the whole program.
+//
+
+#ifndef __cppl__stream__
+#define __cppl__stream__
+
+#include "driver.h"
+
+#include <iostream>
+
+#include <llvm/ADT/SmallVector.h>
+
+// Compile the cppl input of opts into an object in buffer. Returns false and
+// writes to diag on failure.
+bool compileStreaming(CompilerContext &cc, const Options &opts, llvm::SmallVectorImpl<char> &buffer,
+                      std::ostream &diag);
+
+#endif /* defined(__cppl__stream__) */
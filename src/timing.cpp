@@ -0,0 +1,140 @@
+#include "timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+#include <llvm/Pass.h>
+
+bool timingEnabled = false;
+
+struct Span {
+    const char *name;
+    std::string detail;
+    int64_t startUs;
+    int64_t durUs;
+    unsigned tid;
+};
+
+static std::mutex spansLock;
+static std::vector<Span> spans;
+static TimePoint epoch;
+static std::atomic<int64_t> lexNs(0);
+
+static unsigned threadId() {
+    static std::atomic<unsigned> nextId(1);
+    thread_local unsigned id = nextId++;
+    return id;
+}
+
+void enableTiming(bool llvmPasses) {
+    epoch = std::chrono::steady_clock::now();
+    timingEnabled = true;
+    llvm::TimePassesIsEnabled = llvmPasses;
+}
+
+void recordSpan(const char *name, const std::string &detail, TimePoint start) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    auto end = std::chrono::steady_clock::now();
+    Span span = {
+        name,
+        detail,
+        duration_cast<microseconds>(start - epoch).count(),
+        duration_cast<microseconds>(end - start).count(),
+        threadId()
+    };
+
+    std::lock_guard<std::mutex> guard(spansLock);
+    spans.push_back(std::move(span));
+}
+
+void recordLexTime(std::chrono::steady_clock::duration time) {
+    lexNs += std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+void writeTimeReport(std::ostream &os) {
+    struct Total {
+        int64_t us = 0;
+        unsigned count = 0;
+    };
+
+    // Spans of the same kind may nest (e.g. the per-function spans inside
+    // a phase), so each kind is totalled on its own
+    std::map<std::string, Total> totals;
+    {
+        std::lock_guard<std::mutex> guard(spansLock);
+        for (auto &span : spans) {
+            auto &total = totals[span.name];
+            total.us += span.durUs;
+            total.count++;
+        }
+    }
+
+    std::vector<std::pair<std::string, Total>> sorted(totals.begin(), totals.end());
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Total> &a,
+                                               const std::pair<std::string, Total> &b) {
+        return a.second.us > b.second.us;
+    });
+
+    os << "===-------------------------------------------------------------------------===\n"
+       << "                          cppl time report\n"
+       << "===-------------------------------------------------------------------------===\n";
+    char line[128];
+    snprintf(line, sizeof(line), "%12s %8s  %s\n", "Time (ms)", "Count", "Phase");
+    os << line;
+    snprintf(line, sizeof(line), "%12.3f %8s  %s\n", lexNs / 1e6, "", "lex (within parse)");
+    os << line;
+    for (auto &entry : sorted) {
+        snprintf(line, sizeof(line), "%12.3f %8u  %s\n",
+                 entry.second.us / 1e3, entry.second.count, entry.first.c_str());
+        os << line;
+    }
+}
+
+void writeJSONString(std::ostream &os, const std::string &str) {
+    os << '"';
+    for (char c : str) {
+        switch (c) {
+        case '"': os << "\\\""; break;
+        case '\\': os << "\\\\"; break;
+        case '\n': os << "\\n"; break;
+        default:
+            if ((unsigned char) c < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                os << esc;
+            } else {
+                os << c;
+            }
+        }
+    }
+    os << '"';
+}
+
+bool writeTrace(const std::string &path) {
+    std::ofstream os(path);
+    if (! os) return false;
+
+    std::lock_guard<std::mutex> guard(spansLock);
+    os << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (auto &span : spans) {
+        if (first) first = false; else os << ",\n";
+        os << "{\"name\":";
+        writeJSONString(os, span.detail.empty() ? span.name : std::string(span.name) + " " + span.detail);
+        os << ",\"cat\":";
+        writeJSONString(os, span.name);
+        os << ",\"ph\":\"X\",\"ts\":" << span.startUs << ",\"dur\":" << span.durUs
+           << ",\"pid\":" << getpid() << ",\"tid\":" << span.tid << "}";
+    }
+    os << "\n],\"otherData\":{\"lexMs\":" << lexNs / 1e6 << "}}\n";
+
+    return (bool) os;
+}
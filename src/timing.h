@@ -0,0 +1,73 @@
+//
+//  timing.h
+//  cppl
+//
+//  Compile time instrumentation. Phases of the compiler are wrapped in
+//  TimeScopes, which record nothing unless timing has been enabled, and
+//  the results can be summarized (-ftime-report) or written out as Chrome
+//  trace event JSON (--trace=out.json).
+//
+
+#ifndef __cppl__timing__
+#define __cppl__timing__
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+extern bool timingEnabled;
+
+// Start recording TimeScopes. Must be called before any compile starts.
+// If llvmPasses is set, LLVM times its passes too, and reports them itself
+// when it is shut down.
+void enableTiming(bool llvmPasses);
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+// Record a span which started at start and ended now
+void recordSpan(const char *name, const std::string &detail, TimePoint start);
+
+// Add to the total time spent lexing. Lexing is interleaved with parsing
+// one token at a time, so it is accounted for separately from the spans.
+void recordLexTime(std::chrono::steady_clock::duration time);
+
+struct TimeScope {
+    const char *name;
+    std::string detail;
+    TimePoint start;
+
+    explicit TimeScope(const char *name) : name(name) {
+        if (timingEnabled) start = std::chrono::steady_clock::now();
+    }
+
+    TimeScope(const char *name, const std::string &detail) : name(name) {
+        if (timingEnabled) {
+            this->detail = detail;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    // Details are mostly function names, which are only copied into a
+    // string when timing, rather than for every function of every compile
+    TimeScope(const char *name, const char *detail) : name(name) {
+        if (timingEnabled) {
+            this->detail = detail;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TimeScope() {
+        if (timingEnabled) recordSpan(name, detail, start);
+    }
+};
+
+// Print the total time and count of each kind of span
+void writeTimeReport(std::ostream &os);
+
+// Write every span as Chrome trace event JSON. Returns false on failure.
+bool writeTrace(const std::string &path);
+
+// Write str as a quoted JSON string
+void writeJSONString(std::ostream &os, const std::string &str);
+
+#endif /* defined(__cppl__timing__) */
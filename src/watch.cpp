@@ -0,0 +1,297 @@
+#include "watch.h"
+#include "driver.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Events which end a burst of changes once this long passes without another
+static const int settleMs = 10;
+
+static const uint32_t watchEvents = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+    IN_CREATE | IN_DELETE_SELF;
+
+static bool isSource(const std::string &name) {
+    return name.size() > 5 && name.compare(name.size() - 5, 5, ".cppl") == 0;
+}
+
+// Create the directory at path and any of its parents which don't exist
+static void makeDirectories(const std::string &path) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+        if (slash == std::string::npos) return;
+    }
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Watcher {
+    const Options &opts;
+    std::ostream &diag;
+    std::string root;
+    std::string output;
+    std::string incrementalDir;
+    int fd = -1;
+    std::unordered_map<int, std::string> directories; // By watch descriptor
+    // The text of each source as of its last build
+    std::unordered_map<std::string, std::string> sources;
+    // Sources which changed, but couldn't be rebuilt, to try again next time
+    std::set<std::string> unbuilt;
+    CompilerContext cc;
+
+    Watcher(const Options &opts, std::ostream &diag) : opts(opts), diag(diag) {
+        root = opts.inputs[0];
+        while (root.size() > 1 && root.back() == '/') root.pop_back();
+        output = opts.output;
+        while (output.size() > 1 && output.back() == '/') output.pop_back();
+
+        // The database can't hold objects built with -g or -fprofile-generate
+        incrementalDir = opts.incrementalDir;
+        if (incrementalDir.empty() && opts.emit[0].kind == EMIT_OBJ && opts.debugInfo == 0 &&
+            opts.profileGenerate.empty() && ! wantsRemarks(opts)) {
+            incrementalDir = output + "/.cppl-incremental";
+        }
+    }
+
+    ~Watcher() {
+        if (fd >= 0) close(fd);
+    }
+
+    std::string relative(const std::string &path) {
+        return path.substr(root.size() + 1);
+    }
+
+    std::string outputPath(const std::string &source) {
+        auto name = relative(source);
+        name.resize(name.size() - 5);
+        return output + "/" + name + "." + emitExtension(opts.emit[0].kind);
+    }
+
+    // Watch dir and everything under it, adding the sources in it to found
+    void watchDirectory(const std::string &dir, std::vector<std::string> &found) {
+        int wd = inotify_add_watch(fd, dir.c_str(), watchEvents);
+        if (wd < 0) {
+            diag << "cppl: could not watch " << dir << ": " << strerror(errno) << "\n";
+            return;
+        }
+        directories[wd] = dir;
+
+        DIR *d = opendir(dir.c_str());
+        if (d == NULL) return;
+        while (struct dirent *ent = readdir(d)) {
+            // Hidden directories include the incremental database
+            if (ent->d_name[0] == '.') continue;
+            auto path = dir + "/" + ent->d_name;
+
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) continue;
+            if (S_ISDIR(st.st_mode)) {
+                watchDirectory(path, found);
+            } else if (isSource(ent->d_name)) {
+                found.push_back(path);
+            }
+        }
+        closedir(d);
+    }
+
+    // Compile each source in a child process. Returns the exit status.
+    int buildInChild(const std::vector<std::string> &paths) {
+        int status = 0;
+        for (auto &path : paths) {
+            auto start = std::chrono::steady_clock::now();
+
+            Options job = opts;
+            job.mode = MODE_COMPILE;
+            job.inputs = { path };
+            job.output = outputPath(path);
+            job.incrementalDir = incrementalDir;
+            makeDirectories(job.output.substr(0, job.output.find_last_of('/')));
+
+            std::ostringstream jobDiag;
+            bool ok = runJob(cc, job, jobDiag) == 0;
+            if (! ok) status = 1;
+
+            char ms[32];
+            snprintf(ms, sizeof(ms), "%.1f", millisecondsSince(start));
+            diag << jobDiag.str()
+                 << "cppl: " << (ok ? "built " : "failed to build ") << relative(path)
+                 << " (" << ms << " ms)\n";
+        }
+        diag.flush();
+        return status;
+    }
+
+    // Rebuild the sources at paths which have changed since they were last
+    // built, and remove the outputs of those which no longer exist
+    void rebuild(std::set<std::string> paths) {
+        auto start = std::chrono::steady_clock::now();
+        paths.insert(unbuilt.begin(), unbuilt.end());
+        unbuilt.clear();
+
+        std::vector<std::string> changed;
+        std::vector<std::string> texts;
+        for (auto &path : paths) {
+            std::ifstream in(path, std::ios::binary);
+            if (! in) {
+                if (sources.erase(path) != 0) {
+                    unlink(outputPath(path).c_str());
+                    diag << "cppl: removed " << relative(path) << "\n";
+                }
+                continue;
+            }
+
+            std::ostringstream text;
+            text << in.rdbuf();
+            auto found = sources.find(path);
+            if (found != sources.end() && found->second == text.str()) continue;
+            changed.push_back(path);
+            texts.push_back(text.str());
+        }
+        if (changed.empty()) return;
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            diag << "cppl: fork: " << strerror(errno) << "\n";
+            unbuilt.insert(changed.begin(), changed.end());
+            return;
+        }
+        if (pid == 0) {
+            _exit(buildInChild(changed));
+        }
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        for (size_t i=0; i<changed.size(); i++) {
+            sources[changed[i]] = std::move(texts[i]);
+        }
+
+        char ms[32];
+        snprintf(ms, sizeof(ms), "%.1f", millisecondsSince(start));
+        if (WIFSIGNALED(status)) {
+            diag << "cppl: the compiler crashed (signal " << WTERMSIG(status) << ") after " << ms << " ms\n";
+        } else {
+            diag << "cppl: rebuilt " << changed.size() << " of " << sources.size() << " sources in "
+                 << ms << " ms" << (WEXITSTATUS(status) == 0 ? "" : ", with errors") << "\n";
+        }
+    }
+
+    // Wait for a burst of changes to finish, and return the sources it touched
+    bool waitForChanges(std::set<std::string> &paths) {
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        int timeout = -1;
+        for (;;) {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            int ready = poll(&pfd, 1, timeout);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                diag << "cppl: poll: " << strerror(errno) << "\n";
+                return false;
+            }
+            if (ready == 0) return true;
+            timeout = settleMs;
+
+            auto length = read(fd, buffer, sizeof(buffer));
+            if (length < 0) {
+                if (errno == EINTR) continue;
+                diag << "cppl: reading inotify events: " << strerror(errno) << "\n";
+                return false;
+            }
+
+            for (char *p = buffer; p < buffer + length; ) {
+                auto event = (struct inotify_event *) p;
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were lost, so look at everything again
+                    std::vector<std::string> found;
+                    for (auto &entry : directories) inotify_rm_watch(fd, entry.first);
+                    directories.clear();
+                    watchDirectory(root, found);
+                    paths.insert(found.begin(), found.end());
+                    for (auto &entry : sources) paths.insert(entry.first);
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) {
+                    directories.erase(event->wd);
+                    continue;
+                }
+
+                auto dir = directories.find(event->wd);
+                if (dir == directories.end() || event->len == 0) continue;
+                auto name = std::string(event->name);
+                auto path = dir->second + "/" + name;
+
+                if (event->mask & IN_ISDIR) {
+                    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && name[0] != '.') {
+                        std::vector<std::string> found;
+                        watchDirectory(path, found);
+                        paths.insert(found.begin(), found.end());
+                    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                        // Everything which was under it is gone
+                        for (auto &entry : sources) {
+                            if (entry.first.compare(0, path.size() + 1, path + "/") == 0) paths.insert(entry.first);
+                        }
+                    }
+                } else if (isSource(name) && ! (event->mask & IN_CREATE)) {
+                    // A new file is built once it has been written and closed
+                    paths.insert(path);
+                }
+            }
+        }
+    }
+
+    int run() {
+        initializeLLVM();
+
+        fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0) {
+            diag << "cppl: inotify_init1: " << strerror(errno) << "\n";
+            return 1;
+        }
+
+        // Set up the TargetMachine in the watcher, so that every rebuild
+        // inherits it rather than making its own
+        {
+            llvm::LLVMContext context;
+            llvm::Module mod("watch", context);
+            std::string error;
+            if (! cc.targetMachine(mod, opts.optLevel, error)) {
+                diag << "cppl: " << error << "\n";
+                return 1;
+            }
+        }
+
+        makeDirectories(output);
+
+        std::vector<std::string> found;
+        watchDirectory(root, found);
+        rebuild(std::set<std::string>(found.begin(), found.end()));
+        diag << "cppl: watching " << root << "\n";
+
+        for (;;) {
+            std::set<std::string> paths;
+            if (! waitForChanges(paths)) return 1;
+            rebuild(paths);
+        }
+    }
+};
+
+int runWatch(const Options &opts, std::ostream &diag) {
+    Watcher watcher(opts, diag);
+    return watcher.run();
+}
@@ -0,0 +1,31 @@
+//
+//  watch.h
+//  cppl
+//
+//  Watch mode (--watch <dir> -o <OutputDir>/). Every cppl source under the
+//  directory is compiled into the same place under the output directory,
+//  and recompiled whenever inotify reports that it has been written. The
+//  text of each source is kept in memory, so that saves which don't change
+//  it rebuild nothing, and by default the functions of each source are kept
+//  in an incremental database (see incremental.h), so that an edit only
+//  regenerates the functions it touches.
+//
+//  The front end reports errors in the source with assertions, so each
+//  rebuild is made in a child process forked from the watcher. It inherits
+//  LLVM and the watcher's TargetMachines already set up, and a bad edit
+//  only takes the child down with it.
+//
+
+#ifndef __cppl__watch__
+#define __cppl__watch__
+
+#include "options.h"
+
+#include <iostream>
+
+// Build the sources of the directory in opts.inputs[0] into opts.output,
+// and then rebuild them as they change, printing the time each rebuild
+// took to diag. Only returns on error.
+int runWatch(const Options &opts, std::ostream &diag);
+
+#endif /* defined(__cppl__watch__) */